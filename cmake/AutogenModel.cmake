@@ -0,0 +1,93 @@
+# Build-time code generation for autogen functions.
+#
+# autogen_add_model(<target>
+#                   FUNCTOR <functor template>
+#                   HEADER <header that defines the functor>
+#                   INPUT_DIM <input dimension>
+#                   OUTPUT_DIM <output dimension>
+#                   [NAME <function name>]
+#                   [NAMESPACE <namespace of the generated code>]
+#                   [TRACE_INPUT <value>...]
+#                   [GENERATOR <executable>]
+#                   [NO_JACOBIAN])
+#
+# Builds a generator executable that traces `FUNCTOR<Scalar>` (which has to be
+# default-constructible) at build time and exports the forward pass and the
+# Jacobian to the header `<NAME>.hpp` (see `GeneratedCodeGen::export_header`).
+# The header-only (INTERFACE) library `<target>` provides this header; targets
+# that link to it evaluate the function without tracing, compiling or loading
+# any code at runtime. The function is traced at `TRACE_INPUT` (zeros by
+# default).
+#
+# The generator runs on the build host. When cross-compiling, pass the path of
+# a generator built for the host via `GENERATOR` (e.g. the
+# `<target>_generator` executable of a native build of the same project).
+
+set(AUTOGEN_CMAKE_DIR ${CMAKE_CURRENT_LIST_DIR} CACHE INTERNAL "")
+
+function(autogen_add_model target)
+  set(one_value_args
+      FUNCTOR HEADER INPUT_DIM OUTPUT_DIM NAME NAMESPACE GENERATOR)
+  cmake_parse_arguments(ARG "NO_JACOBIAN" "${one_value_args}" "TRACE_INPUT"
+                        ${ARGN})
+  foreach(arg FUNCTOR HEADER INPUT_DIM OUTPUT_DIM)
+    if(NOT ARG_${arg})
+      message(FATAL_ERROR "autogen_add_model(${target}): ${arg} is required.")
+    endif()
+  endforeach()
+  if(NOT ARG_NAME)
+    set(ARG_NAME ${target})
+  endif()
+  if(NOT ARG_NAMESPACE)
+    set(ARG_NAMESPACE ${ARG_NAME})
+  endif()
+
+  get_filename_component(AUTOGEN_MODEL_HEADER ${ARG_HEADER} ABSOLUTE)
+  set(AUTOGEN_MODEL_FUNCTOR ${ARG_FUNCTOR})
+  set(AUTOGEN_MODEL_NAME ${ARG_NAME})
+  set(AUTOGEN_MODEL_NAMESPACE ${ARG_NAMESPACE})
+  set(AUTOGEN_MODEL_INPUT_DIM ${ARG_INPUT_DIM})
+  set(AUTOGEN_MODEL_OUTPUT_DIM ${ARG_OUTPUT_DIM})
+  string(REPLACE ";" ", " AUTOGEN_MODEL_TRACE_INPUT "${ARG_TRACE_INPUT}")
+  if(ARG_NO_JACOBIAN)
+    set(AUTOGEN_MODEL_JACOBIAN false)
+  else()
+    set(AUTOGEN_MODEL_JACOBIAN true)
+  endif()
+
+  set(model_dir ${CMAKE_CURRENT_BINARY_DIR}/${target}_autogen)
+  set(model_header ${model_dir}/include/${ARG_NAME}.hpp)
+  if(ARG_GENERATOR)
+    set(generator ${ARG_GENERATOR})
+  elseif(CMAKE_CROSSCOMPILING)
+    message(FATAL_ERROR "autogen_add_model(${target}): the generator has to "
+                        "run on the build host, pass a generator built for "
+                        "the host via GENERATOR when cross-compiling.")
+  else()
+    configure_file(${AUTOGEN_CMAKE_DIR}/autogen_model_generator.cpp.in
+                   ${model_dir}/${target}_generator.cpp @ONLY)
+    add_executable(${target}_generator ${model_dir}/${target}_generator.cpp)
+    target_link_libraries(${target}_generator autogen)
+    set(generator ${target}_generator)
+  endif()
+
+  file(MAKE_DIRECTORY ${model_dir}/include)
+  add_custom_command(
+    OUTPUT ${model_header}
+    COMMAND ${generator} ${model_header}
+    WORKING_DIRECTORY ${model_dir}
+    DEPENDS ${generator} ${AUTOGEN_MODEL_HEADER}
+    COMMENT "Generating code for autogen function ${ARG_NAME}")
+  add_custom_target(${target}_header DEPENDS ${model_header})
+
+  # the generated functions are inline, so there is nothing to archive
+  add_library(${target} INTERFACE)
+  target_include_directories(${target} INTERFACE ${model_dir}/include)
+  if(CMAKE_VERSION VERSION_LESS 3.19)
+    # interface libraries cannot have dependencies before CMake 3.19, the
+    # header is generated for the targets that have it as a source instead
+    target_sources(${target} INTERFACE ${model_header})
+  else()
+    add_dependencies(${target} ${target}_header)
+  endif()
+endfunction()
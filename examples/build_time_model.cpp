@@ -0,0 +1,28 @@
+#include <array>
+#include <cstdlib>
+#include <iostream>
+
+// generated at build time by autogen_add_model(), see CMakeLists.txt
+#include "rosenbrock.hpp"
+
+int main() {
+  std::array<double, rosenbrock::input_dim> input;
+  for (std::size_t i = 0; i < input.size(); ++i) {
+    input[i] = 0.1 * static_cast<double>(i);
+  }
+  std::array<double, rosenbrock::output_dim> output;
+  std::array<double, rosenbrock::output_dim * rosenbrock::input_dim> jacobian;
+  rosenbrock::forward(input, output);
+  rosenbrock::jacobian(input, jacobian);
+
+  std::cout << "output:";
+  for (double y : output) {
+    std::cout << " " << y;
+  }
+  std::cout << "\njacobian:";
+  for (double j : jacobian) {
+    std::cout << " " << j;
+  }
+  std::cout << "\n";
+  return EXIT_SUCCESS;
+}
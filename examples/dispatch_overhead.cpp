@@ -0,0 +1,65 @@
+#include <iostream>
+
+#include "autogen/autogen.hpp"
+#include "autogen/utils/stopwatch.hpp"
+
+constexpr int kNumEvaluations = 1000000;
+
+// a function that is cheap enough for the per-call overhead to dominate
+template <typename Scalar>
+struct tiny_function {
+  void operator()(const std::vector<Scalar> &input,
+                  std::vector<Scalar> &output) const {
+    output[0] = input[0] * input[1] + input[2];
+  }
+};
+
+template <typename Fun>
+double nanoseconds_per_call(Fun fun) {
+  autogen::Stopwatch timer;
+  timer.start();
+  for (int i = 0; i < kNumEvaluations; ++i) {
+    fun();
+  }
+  return timer.stop() / kNumEvaluations * 1e9;
+}
+
+void benchmark(autogen::GenerationMode mode) {
+  std::vector<double> input{0.3, 0.7, 1.1}, output(1);
+  std::vector<double> global_input{0.3};
+  std::vector<std::vector<double>> local_inputs{{0.7, 1.1}}, outputs;
+
+  autogen::Generated<tiny_function> gen("tiny_function_" +
+                                        autogen::str(mode));
+  gen.set_mode(mode);
+  // the first calls trace and compile the function
+  gen(input, output);
+  gen(local_inputs, outputs, global_input);
+
+  std::cout << "### " << mode << " (ready: " << std::boolalpha
+            << gen.is_ready() << ")\n";
+  std::cout << "  forward:          "
+            << nanoseconds_per_call([&]() { gen(input, output); })
+            << " ns/call\n";
+  std::cout << "  raw forward:      " << nanoseconds_per_call([&]() {
+    gen(input.data(), output.data());
+  }) << " ns/call\n";
+  std::cout << "  batched forward:  " << nanoseconds_per_call([&]() {
+    gen(local_inputs, outputs, global_input);
+  }) << " ns/call\n";
+}
+
+int main(int argc, char *argv[]) {
+  // baseline: calling the functor directly
+  std::vector<double> input{0.3, 0.7, 1.1}, output(1);
+  tiny_function<double> f;
+  std::cout << "### functor\n";
+  std::cout << "  forward:          "
+            << nanoseconds_per_call([&]() { f(input, output); })
+            << " ns/call\n";
+
+  benchmark(autogen::GENERATE_NONE);
+  benchmark(autogen::GENERATE_CPPAD);
+  benchmark(autogen::GENERATE_CPU);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+#include <filesystem>
+#include <iostream>
+
+#include "autogen/autogen.hpp"
+#include "autogen/utils/stopwatch.hpp"
+
+constexpr std::size_t kNumBlocks = 64;
+constexpr std::size_t kBlockDim = 3;
+constexpr int kNumEvaluations = 10000;
+
+// computes the same expressions for each block of the input
+template <typename Scalar>
+struct repeated_blocks {
+  void operator()(const std::vector<Scalar> &input,
+                  std::vector<Scalar> &output) const {
+    using std::cos, std::sin;
+    for (std::size_t b = 0; b < kNumBlocks; ++b) {
+      const Scalar &x = input[b * kBlockDim + 0];
+      const Scalar &y = input[b * kBlockDim + 1];
+      const Scalar &z = input[b * kBlockDim + 2];
+      output[b * kBlockDim + 0] = sin(x) * y + z * z;
+      output[b * kBlockDim + 1] = cos(y) * z - x;
+      output[b * kBlockDim + 2] = x * y * z + sin(z);
+    }
+  }
+};
+
+std::uintmax_t directory_size(const std::string &dirname) {
+  namespace fs = std::filesystem;
+  std::uintmax_t size = 0;
+  if (!fs::is_directory(dirname)) {
+    return size;
+  }
+  for (const auto &entry : fs::recursive_directory_iterator(dirname)) {
+    if (entry.is_regular_file()) {
+      size += entry.file_size();
+    }
+  }
+  return size;
+}
+
+void benchmark(const std::string &name, bool detect_loops) {
+  std::vector<double> input(kNumBlocks * kBlockDim),
+      output(kNumBlocks * kBlockDim), jacobian;
+  for (std::size_t i = 0; i < input.size(); ++i) {
+    input[i] = 0.01 * static_cast<double>(i);
+  }
+
+  autogen::Generated<repeated_blocks> gen(name);
+  gen.set_mode(autogen::GENERATE_CPU);
+  if (detect_loops) {
+    // outputs that are kBlockDim entries apart share the same expressions
+    std::vector<std::set<std::size_t>> related(kBlockDim);
+    for (std::size_t i = 0; i < output.size(); ++i) {
+      related[i % kBlockDim].insert(i);
+    }
+    gen.set_related_dependents(related);
+  }
+
+  autogen::Stopwatch timer;
+  timer.start();
+  gen(input, output);
+  double compile_time = timer.stop();
+
+  timer.start();
+  for (int i = 0; i < kNumEvaluations; ++i) {
+    gen(input, output);
+  }
+  double forward_time = timer.stop();
+
+  timer.start();
+  for (int i = 0; i < kNumEvaluations; ++i) {
+    gen.jacobian(input, jacobian);
+  }
+  double jacobian_time = timer.stop();
+
+  std::cout << "### " << name << "\n";
+  std::cout << "  source size:   " << directory_size(name + "_cpu_srcs")
+            << " bytes\n";
+  std::cout << "  trace + compile time: " << compile_time << " s\n";
+  std::cout << "  forward pass:  " << forward_time / kNumEvaluations * 1e6
+            << " us\n";
+  std::cout << "  Jacobian pass: " << jacobian_time / kNumEvaluations * 1e6
+            << " us\n";
+}
+
+int main(int argc, char *argv[]) {
+  benchmark("repeated_blocks_unrolled", false);
+  benchmark("repeated_blocks_loops", true);
+  return EXIT_SUCCESS;
+}
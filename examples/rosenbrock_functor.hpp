@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+
+// residuals of the Rosenbrock function
+template <typename Scalar>
+struct rosenbrock_residuals {
+  void operator()(const std::vector<Scalar> &input,
+                  std::vector<Scalar> &output) const {
+    for (std::size_t i = 0; i + 1 < input.size(); ++i) {
+      output[2 * i] = 10.0 * (input[i + 1] - input[i] * input[i]);
+      output[2 * i + 1] = 1.0 - input[i];
+    }
+  }
+};
@@ -0,0 +1,142 @@
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "autogen/autogen.hpp"
+
+namespace {
+int failures = 0;
+
+void check(bool condition, const std::string &what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << "\n";
+    ++failures;
+  }
+}
+
+// code generator of a function with the given output dimension that has not
+// been traced
+struct UntracedCodeGen : public autogen::GeneratedCodeGen {
+  explicit UntracedCodeGen(int output_dim)
+      : autogen::GeneratedCodeGen("untraced") {
+    output_dim_ = output_dim;
+  }
+};
+
+void test_backend_selector() {
+  using autogen::BackendDecision;
+  autogen::BackendSelector selector;
+
+  // every backend is measured once, the numerical backend only for the
+  // forward pass
+  BackendDecision d = selector.select("forward", false, 10, false);
+  check(d.mode == autogen::GENERATE_NONE, "numerical backend is measured");
+  selector.record(d, 1.0, false, false);
+  d = selector.select("forward", false, 10, false);
+  check(d.mode == autogen::GENERATE_CPPAD, "CppAD backend is measured");
+  selector.record(d, 0.5, false, false);
+  d = selector.select("jacobian", true, 10, false);
+  check(d.mode == autogen::GENERATE_CPPAD,
+        "the Jacobian is never approximated numerically");
+
+  // the cheapest measured backend is chosen until the interpreted backends
+  // have taken as long as a compilation
+  d = selector.select("forward", false, 10, false);
+  check(d.mode == autogen::GENERATE_CPPAD && d.reason == "cheapest",
+        "the cheapest interpreted backend is chosen");
+  check(d.predicted_time > 0.49 && d.predicted_time < 0.51,
+        "the predicted time follows the measurement");
+  selector.expected_compile_time = 1.0;
+  d = selector.select("forward", false, 10, false);
+  check(d.mode == autogen::GENERATE_CPU,
+        "the CPU code is compiled after the interpreted time");
+  selector.allow_compilation = false;
+  d = selector.select("forward", false, 10, false);
+  check(d.mode == autogen::GENERATE_CPPAD,
+        "nothing is compiled if compilation is not allowed");
+
+  // compiling records the compile time but not the cost of the backend
+  d = selector.select("forward", false, 10, true);
+  check(d.mode == autogen::GENERATE_CPU, "the compiled backend is measured");
+  selector.record(d, 3.0, false, true);
+  check(selector.expected_compile_time == 3.0,
+        "the measured compile time is expected next time");
+  d = selector.select("forward", false, 10, true);
+  check(d.mode == autogen::GENERATE_CPU && d.reason == "not measured yet",
+        "compiling does not count as a measurement");
+  selector.record(d, 0.01, false, false);
+  d = selector.select("forward", false, 10, true);
+  check(d.mode == autogen::GENERATE_CPU && d.reason == "cheapest",
+        "the compiled backend is the cheapest");
+
+  // the cost is modeled as a linear function of the number of samples
+  autogen::BackendSelector scaling;
+  auto measure = [&](autogen::GenerationMode mode, std::size_t num_samples,
+                     double time) {
+    BackendDecision measured;
+    measured.entry_point = "forward";
+    measured.mode = mode;
+    measured.num_samples = num_samples;
+    scaling.record(measured, time, false, false);
+  };
+  measure(autogen::GENERATE_NONE, 1, 1.0);
+  measure(autogen::GENERATE_CPPAD, 1, 0.001);
+  measure(autogen::GENERATE_CPPAD, 1000, 1.0);
+  measure(autogen::GENERATE_CPU, 1, 0.01);
+  measure(autogen::GENERATE_CPU, 1000, 0.02);
+  check(scaling.select("forward", false, 1, true).mode ==
+            autogen::GENERATE_CPPAD,
+        "small batches are cheapest without the call overhead");
+  check(scaling.select("forward", false, 1000, true).mode ==
+            autogen::GENERATE_CPU,
+        "large batches are cheapest in the compiled backend");
+
+  check(selector.decisions().size() == 4, "decisions are logged");
+  selector.max_log_size = 1;
+  selector.record(d, 0.01, false, false);
+  check(selector.decisions().size() == 1, "the log is bounded");
+
+  selector.reset();
+  d = selector.select("forward", false, 10, true);
+  check(d.mode == autogen::GENERATE_NONE && d.reason == "not measured yet",
+        "resetting forgets the measurements");
+}
+
+void test_repeated_output_blocks() {
+  UntracedCodeGen gen(7);
+  gen.set_repeated_output_blocks(3);
+  const std::vector<std::set<std::size_t>> expected = {
+      {0, 3, 6}, {1, 4}, {2, 5}};
+  check(gen.related_dependents == expected,
+        "outputs 3 indices apart are related");
+
+  gen.set_repeated_output_blocks(7);
+  check(gen.related_dependents.empty(),
+        "a single block has no related outputs");
+  gen.set_repeated_output_blocks(2);
+  gen.set_repeated_output_blocks(0);
+  check(gen.related_dependents.empty(),
+        "a block size of 0 clears the related outputs");
+
+  UntracedCodeGen unknown(-1);
+  unknown.set_repeated_output_blocks(3);
+  check(unknown.related_dependents.empty(),
+        "no outputs are related before the output dimension is known");
+}
+}  // namespace
+
+// The backend selection of GENERATE_AUTO mode and the output blocks that are
+// marked for loop detection follow from the recorded measurements and the
+// output dimension alone.
+int main() {
+  test_backend_selector();
+  test_repeated_output_blocks();
+  if (failures > 0) {
+    std::cerr << failures << " check(s) failed.\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << "All checks passed.\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "autogen/core/autotuning.hpp"
+#include "autogen/core/batch_layout.hpp"
+#include "autogen/core/isa_dispatch.hpp"
+
+namespace {
+int failures = 0;
+
+void check(bool condition, const std::string &what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << "\n";
+    ++failures;
+  }
+}
+
+void test_layout_strides() {
+  using autogen::BatchLayout;
+  const std::size_t n = 5, dim = 3;
+
+  const BatchLayout aos;
+  check(aos.offset(2, n, dim) == 6, "AoS offset");
+  check(aos.stride(n) == 1, "AoS stride");
+  check(aos.size(n, dim) == 15, "AoS size");
+
+  const BatchLayout soa(autogen::LAYOUT_SOA);
+  check(soa.offset(2, n, dim) == 2, "SoA offset");
+  check(soa.stride(n) == n, "SoA stride");
+  check(soa.size(n, dim) == 15, "SoA size");
+
+  // blocks of 2 vectors, the last block is padded
+  const BatchLayout interleaved(autogen::LAYOUT_INTERLEAVED, 2);
+  check(interleaved.offset(0, n, dim) == 0, "interleaved offset of vector 0");
+  check(interleaved.offset(1, n, dim) == 1, "interleaved offset of vector 1");
+  check(interleaved.offset(3, n, dim) == 7, "interleaved offset of vector 3");
+  check(interleaved.offset(4, n, dim) == 12, "interleaved offset of vector 4");
+  check(interleaved.stride(n) == 2, "interleaved stride");
+  check(interleaved.size(n, dim) == 18, "interleaved size");
+
+  bool thrown = false;
+  try {
+    BatchLayout(autogen::LAYOUT_INTERLEAVED, 0);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  check(thrown, "interleaved layout without lanes is rejected");
+
+  // every entry has its own position in the buffer, and scattering and
+  // gathering the batch restores it
+  std::vector<std::vector<double>> vectors(n, std::vector<double>(dim));
+  for (std::size_t s = 0; s < n; ++s) {
+    for (std::size_t i = 0; i < dim; ++i) {
+      vectors[s][i] = static_cast<double>(s * dim + i + 1);
+    }
+  }
+  for (const BatchLayout &layout : {aos, soa, interleaved}) {
+    std::vector<double> buffer(layout.size(n, dim), 0.0);
+    autogen::scatter_batch(vectors, buffer.data(), layout);
+    std::size_t written = 0;
+    for (double v : buffer) {
+      written += v != 0.0;
+    }
+    check(written == n * dim, "scattered entries do not overlap");
+    std::vector<std::vector<double>> gathered;
+    autogen::gather_batch(n, dim, buffer.data(), layout, gathered);
+    check(gathered == vectors, "gather restores the scattered batch");
+  }
+}
+
+void test_jacobian_positions() {
+  check(autogen::jacobian_positions(2, 3, autogen::ROW_MAJOR).empty(),
+        "row-major Jacobians need no positions");
+  const auto positions =
+      autogen::jacobian_positions(2, 3, autogen::COLUMN_MAJOR);
+  check(positions == std::vector<std::size_t>{0, 2, 4, 1, 3, 5},
+        "column-major positions of a 2 x 3 Jacobian");
+
+  // the row-major Jacobian [[1, 2, 3], [4, 5, 6]] stored column-major
+  const std::vector<double> jacobian = {1, 2, 3, 4, 5, 6};
+  std::vector<double> buffer(6);
+  autogen::scatter_sample(0, 1, 6, jacobian.data(), buffer.data(),
+                          autogen::BatchLayout(), positions);
+  check(buffer == std::vector<double>{1, 4, 2, 5, 3, 6},
+        "column-major Jacobian in the buffer");
+}
+
+void test_tuning_round_trip() {
+  const std::string filename = "test_batch_utilities_tuning.txt";
+  autogen::TuningResult tuning;
+  tuning.forward = {4, 16, 0};
+  tuning.forward_tuned = true;
+  tuning.jacobian = {2, 0, 128};
+  tuning.jacobian_tuned = true;
+  tuning.save(filename, "round trip");
+
+  autogen::TuningResult loaded;
+  check(loaded.load(filename), "tuning file is loaded");
+  check(loaded.forward_tuned && loaded.jacobian_tuned,
+        "both passes are tuned after loading");
+  check(loaded.forward.num_threads == 4 && loaded.forward.chunk_size == 16 &&
+            loaded.forward.gpu_threads_per_block == 0,
+        "forward settings survive the round trip");
+  check(loaded.jacobian.num_threads == 2 && loaded.jacobian.chunk_size == 0 &&
+            loaded.jacobian.gpu_threads_per_block == 128,
+        "Jacobian settings survive the round trip");
+
+  // untuned passes are not written and keep their defaults
+  autogen::TuningResult forward_only;
+  forward_only.forward = {3, 1, 0};
+  forward_only.forward_tuned = true;
+  forward_only.jacobian = {8, 8, 8};
+  forward_only.save(filename, "forward only");
+  check(loaded.load(filename), "forward-only tuning file is loaded");
+  check(loaded.forward_tuned && !loaded.jacobian_tuned,
+        "only the forward pass is tuned");
+  check(loaded.jacobian.num_threads == 0 && loaded.jacobian.chunk_size == 0,
+        "untuned Jacobian settings are the defaults");
+
+  // files from machines with a different number of hardware threads are
+  // ignored
+  {
+    std::ofstream file(filename);
+    file << "hardware_threads " << std::thread::hardware_concurrency() + 1
+         << "\nforward 1 1 0\n";
+  }
+  check(!loaded.load(filename), "tuning of another machine is ignored");
+  std::remove(filename.c_str());
+  check(!loaded.load(filename), "missing tuning file is not loaded");
+}
+
+void test_isa_manifest() {
+  const std::string library = "test_batch_utilities_isa";
+  check(autogen::isa_library_name(library, "") == library,
+        "baseline library name");
+  check(autogen::isa_library_name(library, "avx2") == library + "_avx2",
+        "variant library name");
+  check(autogen::select_isa_variant(library).empty(),
+        "libraries without a manifest load the baseline");
+
+  autogen::write_isa_manifest(
+      library, {{"future", {"-mfuture"}, {"no_such_feature"}},
+                {"portable", {"-O3"}, {}}});
+  std::ifstream file(autogen::isa_manifest_filename(library));
+  std::string first, second;
+  std::getline(file, first);
+  std::getline(file, second);
+  check(first == "future no_such_feature", "manifest lists the features");
+  check(second == "portable", "manifest lists variants without features");
+  file.close();
+  check(autogen::select_isa_variant(library) == "portable",
+        "the first supported variant is selected");
+
+  autogen::write_isa_manifest(library,
+                              {{"future", {}, {"avx2", "no_such_feature"}}});
+  check(autogen::select_isa_variant(library).empty(),
+        "variants with an unsupported feature are skipped");
+
+  autogen::write_isa_manifest(library, {{"avx2", {"-mavx2"}, {"avx2"}}});
+  check(autogen::select_isa_variant(library) ==
+            (autogen::cpu_supports("avx2") ? "avx2" : ""),
+        "variants are selected by the features of the CPU");
+  std::remove(autogen::isa_manifest_filename(library).c_str());
+}
+}  // namespace
+
+// The stride math of the batch layouts, the positions of column-major
+// Jacobians, the tuning files and the ISA manifests have to be consistent
+// between writing and reading.
+int main() {
+  test_layout_strides();
+  test_jacobian_positions();
+  test_tuning_round_trip();
+  test_isa_manifest();
+  if (failures > 0) {
+    std::cerr << failures << " check(s) failed.\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << "All checks passed.\n";
+  return EXIT_SUCCESS;
+}
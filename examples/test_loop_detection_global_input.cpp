@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+
+#include "autogen/autogen.hpp"
+
+namespace {
+constexpr std::size_t kNumBlocks = 16;
+constexpr std::size_t kBlockDim = 3;
+constexpr std::size_t kNumParams = 2;
+
+// the same expressions for each block of the input, scaled by the parameters
+// at the front of the input
+template <typename Scalar>
+struct scaled_blocks {
+  void operator()(const std::vector<Scalar> &input,
+                  std::vector<Scalar> &output) const {
+    using std::sin;
+    const Scalar &a = input[0];
+    const Scalar &b = input[1];
+    for (std::size_t k = 0; k < kNumBlocks; ++k) {
+      const Scalar &x = input[kNumParams + k * kBlockDim + 0];
+      const Scalar &y = input[kNumParams + k * kBlockDim + 1];
+      const Scalar &z = input[kNumParams + k * kBlockDim + 2];
+      output[k * kBlockDim + 0] = a * sin(x) * y + z;
+      output[k * kBlockDim + 1] = b * y * z - x;
+      output[k * kBlockDim + 2] = a * x + b * sin(z);
+    }
+  }
+};
+
+double max_difference(const std::vector<std::vector<double>> &a,
+                      const std::vector<std::vector<double>> &b) {
+  double diff = a.size() == b.size() ? 0.0 : HUGE_VAL;
+  for (std::size_t i = 0; i < a.size() && i < b.size(); ++i) {
+    for (std::size_t j = 0; j < a[i].size() && j < b[i].size(); ++j) {
+      diff = std::max(diff, std::abs(a[i][j] - b[i][j]));
+    }
+  }
+  return diff;
+}
+}  // namespace
+
+// A function with a global input and loop detection enabled has to compile
+// and match the numerical evaluation (pass --cuda to test the CUDA backend).
+int main(int argc, char *argv[]) {
+  const bool cuda = argc > 1 && std::string(argv[1]) == "--cuda";
+  const std::size_t output_dim = kNumBlocks * kBlockDim;
+
+  std::vector<double> params = {0.5, 2.0};
+  std::vector<std::vector<double>> local_inputs(8);
+  for (std::size_t i = 0; i < local_inputs.size(); ++i) {
+    local_inputs[i].resize(kNumBlocks * kBlockDim);
+    for (std::size_t j = 0; j < local_inputs[i].size(); ++j) {
+      local_inputs[i][j] = 0.01 * static_cast<double>(i + j);
+    }
+  }
+
+  autogen::Generated<scaled_blocks> reference("scaled_blocks_reference");
+  reference.set_mode(autogen::GENERATE_CPPAD);
+  std::vector<std::vector<double>> expected, expected_jacobians;
+  reference(local_inputs, expected, params);
+  reference.jacobian(local_inputs, expected_jacobians, params);
+
+  autogen::Generated<scaled_blocks> gen("scaled_blocks_loops");
+  gen.set_mode(cuda ? autogen::GENERATE_CUDA : autogen::GENERATE_CPU);
+  std::vector<std::set<std::size_t>> related(kBlockDim);
+  for (std::size_t i = 0; i < output_dim; ++i) {
+    related[i % kBlockDim].insert(i);
+  }
+  gen.set_related_dependents(related);
+  std::vector<std::vector<double>> outputs, jacobians;
+  gen(local_inputs, outputs, params);
+  gen.jacobian(local_inputs, jacobians, params);
+
+  const double forward_error = max_difference(outputs, expected);
+  const double jacobian_error = max_difference(jacobians, expected_jacobians);
+  std::cout << "forward error: " << forward_error
+            << "  Jacobian error: " << jacobian_error << "\n";
+  if (forward_error > 1e-6 || jacobian_error > 1e-6) {
+    std::cerr << "Loop detection with global input produced wrong results.\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
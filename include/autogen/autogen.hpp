@@ -1,6 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <tuple>
+#include <type_traits>
 
 // clang-format off
 #include "utils/system.hpp"
@@ -16,7 +25,9 @@ enum GenerationMode {
   GENERATE_NONE,
   GENERATE_CPPAD,
   GENERATE_CPU,
-  GENERATE_CUDA
+  GENERATE_CUDA,
+  // selects the cheapest of the CPU-side backends for each call
+  GENERATE_AUTO
 };
 
 static inline std::string str(const GenerationMode& mode) {
@@ -29,6 +40,8 @@ static inline std::string str(const GenerationMode& mode) {
       return "CPU";
     case GENERATE_CUDA:
       return "CUDA";
+    case GENERATE_AUTO:
+      return "Auto";
   }
   return "Unknown";
 }
@@ -39,6 +52,173 @@ static inline std::ostream& operator<<(std::ostream& os,
   return os;
 }
 
+/**
+ * Backend chosen for a call in `GENERATE_AUTO` mode.
+ */
+struct BackendDecision {
+  std::string entry_point;
+  std::size_t num_samples{0};
+  GenerationMode mode{GENERATE_NONE};
+  // why the backend has been chosen
+  std::string reason;
+  // predicted (0 if unknown) and measured duration of the call in seconds
+  double predicted_time{0};
+  double measured_time{0};
+};
+
+/**
+ * Chooses the backend of each call in `GENERATE_AUTO` mode based on the
+ * measured cost of previous calls. The duration of a call is modeled per
+ * backend and entry point type (forward or Jacobian) as a linear function of
+ * the number of samples, fitted to exponentially weighted measurements.
+ * Every backend is measured once before the cheapest one is chosen. The
+ * numerical backend is only considered for the forward pass since its
+ * Jacobian is approximate.
+ *
+ * The CPU code is compiled once the time spent in the interpreted backends
+ * (numerical and CppAD) reaches the expected compile time, which bounds the
+ * total time to at most twice the time of the best decision in hindsight.
+ */
+class BackendSelector {
+ public:
+  // weight of the previous measurements when a new one is added
+  double decay{0.9};
+  // expected duration of compiling the CPU code in seconds, replaced by the
+  // measured duration after every compilation
+  double expected_compile_time{5.0};
+  // whether the CPU code may be compiled
+  bool allow_compilation{true};
+  // number of decisions kept in the log
+  std::size_t max_log_size{1000};
+
+  BackendDecision select(const std::string& entry_point, bool jacobian,
+                         std::size_t num_samples, bool cpu_compiled) const {
+    BackendDecision decision;
+    decision.entry_point = entry_point;
+    decision.num_samples = num_samples;
+    std::vector<GenerationMode> candidates;
+    if (!jacobian) {
+      candidates.push_back(GENERATE_NONE);
+    }
+    candidates.push_back(GENERATE_CPPAD);
+    if (cpu_compiled) {
+      candidates.push_back(GENERATE_CPU);
+    }
+    for (GenerationMode mode : candidates) {
+      if (cost(mode, jacobian).empty()) {
+        decision.mode = mode;
+        decision.reason = "not measured yet";
+        return decision;
+      }
+    }
+    if (!cpu_compiled && allow_compilation &&
+        interpreted_time_ >= expected_compile_time) {
+      decision.mode = GENERATE_CPU;
+      decision.reason = "compile after " + std::to_string(interpreted_time_) +
+                        " s in interpreted backends";
+      return decision;
+    }
+    decision.predicted_time = std::numeric_limits<double>::infinity();
+    for (GenerationMode mode : candidates) {
+      const double t = cost(mode, jacobian).predict(num_samples);
+      if (t < decision.predicted_time) {
+        decision.mode = mode;
+        decision.predicted_time = t;
+      }
+    }
+    decision.reason = "cheapest";
+    return decision;
+  }
+
+  /**
+   * Records the measured duration of a call. If `prepared` is true, the call
+   * included tracing or compiling the backend and is not used to model its
+   * cost.
+   */
+  void record(BackendDecision decision, double measured_time, bool jacobian,
+              bool prepared) {
+    decision.measured_time = measured_time;
+    if (prepared) {
+      decision.reason += decision.mode == GENERATE_CPU ? " (compiled)"
+                                                       : " (traced)";
+      if (decision.mode == GENERATE_CPU) {
+        expected_compile_time = measured_time;
+      }
+    } else {
+      costs_[{decision.mode, jacobian}].add(
+          static_cast<double>(decision.num_samples), measured_time, decay);
+    }
+    if (decision.mode != GENERATE_CPU) {
+      interpreted_time_ += measured_time;
+    }
+    log_.push_back(decision);
+    while (log_.size() > max_log_size) {
+      log_.pop_front();
+    }
+  }
+
+  const std::deque<BackendDecision>& decisions() const { return log_; }
+
+  /**
+   * Forgets the cost measurements, e.g. after the function has been compiled
+   * again.
+   */
+  void reset() {
+    costs_.clear();
+    interpreted_time_ = 0;
+  }
+
+  void print(std::ostream& os = std::cout) const {
+    os << "Backend decisions (last " << log_.size() << ")\n";
+    for (const auto& d : log_) {
+      os << "  " << std::left << std::setw(18) << d.entry_point << std::right
+         << " samples: " << d.num_samples << "  backend: " << str(d.mode)
+         << "  predicted: " << d.predicted_time * 1e6 << " us"
+         << "  measured: " << d.measured_time * 1e6 << " us  (" << d.reason
+         << ")\n";
+    }
+  }
+
+ private:
+  // exponentially weighted least-squares fit of t = a + b * n
+  struct CostModel {
+    double w{0}, sn{0}, st{0}, snn{0}, snt{0};
+
+    bool empty() const { return w == 0; }
+
+    void add(double n, double t, double decay) {
+      w = w * decay + 1;
+      sn = sn * decay + n;
+      st = st * decay + t;
+      snn = snn * decay + n * n;
+      snt = snt * decay + n * t;
+    }
+
+    double predict(double n) const {
+      const double mean_n = sn / w;
+      const double mean_t = st / w;
+      const double var = snn / w - mean_n * mean_n;
+      if (var <= 1e-9 * (1 + mean_n * mean_n)) {
+        // a single batch size has been measured so far
+        return mean_t * n / std::max(mean_n, 1.0);
+      }
+      const double b = std::max((snt / w - mean_n * mean_t) / var, 0.0);
+      const double a = std::max(mean_t - b * mean_n, 0.0);
+      return a + b * n;
+    }
+  };
+
+  std::map<std::pair<GenerationMode, bool>, CostModel> costs_;
+  double interpreted_time_{0};
+  std::deque<BackendDecision> log_;
+
+  const CostModel& cost(GenerationMode mode, bool jacobian) const {
+    static const CostModel unmeasured;
+    const auto it = costs_.find({mode, jacobian});
+    return it == costs_.end() ? unmeasured : it->second;
+  }
+};
+
 template <template <typename> typename Functor>
 struct Generated {
   static inline std::map<std::string, FunctionTrace<BaseScalar>> traces;
@@ -49,15 +229,37 @@ struct Generated {
   using CGScalar = typename CppAD::cg::CG<BaseScalar>;
   using ADCGScalar = typename CppAD::AD<CGScalar>;
   using ADFun = typename FunctionTrace<BaseScalar>::ADFun;
+  using ComplexScalar = typename GeneratedNumerical::ComplexScalar;
 
   bool compile_in_background{false};
   bool is_compiling_{false};
 
+  /**
+   * Whether to free all tracing state (the CppAD and CppADCodeGen functor
+   * instances, the tapes, and the traces of atomic functions) once the
+   * compiled library has been loaded. The functors are recreated when the
+   * function needs to be traced again. If the exact Jacobian is compiled
+   * later (see `set_lazy_jacobian()` and `set_finite_difference_jacobian()`),
+   * the traces are kept until its library has been adopted.
+   */
+  bool release_traces_after_compile{false};
+
+  /**
+   * Number of threads that record independent atomic functions concurrently
+   * while the function is traced for code generation (0 uses all hardware
+   * threads). Only enable this if the functors of the atomic functions are
+   * thread-safe.
+   */
+  std::size_t num_trace_threads{1};
+
  protected:
   std::unique_ptr<Functor<BaseScalar>> f_double_{nullptr};
   std::unique_ptr<Functor<ADScalar>> f_cppad_{nullptr};
   std::unique_ptr<Functor<ADCGScalar>> f_cg_{nullptr};
 
+  std::function<std::unique_ptr<Functor<ADScalar>>()> make_f_cppad_;
+  std::function<std::unique_ptr<Functor<ADCGScalar>>()> make_f_cg_;
+
   std::unique_ptr<GeneratedNumerical> gen_double_{nullptr};
   std::unique_ptr<GeneratedCppAD> gen_cppad_{nullptr};
   std::unique_ptr<GeneratedCodeGen> gen_cg_{nullptr};
@@ -67,18 +269,68 @@ struct Generated {
   int output_dim_{0};
 
   bool debug_mode_{false};
+  bool profile_performance_{false};
+  bool finite_difference_jacobian_{false};
+  bool sparse_cppad_jacobian_{false};
+  bool upgrade_to_exact_jacobian_{false};
+  bool lazy_jacobian_{false};
+  bool background_jacobian_{false};
+  bool annotate_sources_{false};
+  bool autotune_on_first_use_{false};
+  std::vector<IsaVariant> isa_variants_;
+
+  std::vector<std::set<std::size_t>> related_dependents_;
 
   GenerationMode mode_{GENERATE_CPU};
   mutable std::mutex compilation_mutex_;
 
+  /**
+   * Backend that evaluates the function once it has been compiled for the
+   * current settings. Calls are dispatched to it directly without going
+   * through `conditionally_compile()`. Every change that requires the
+   * function to be traced or compiled again resets it.
+   */
+  GeneratedBase* ready_{nullptr};
+
+  BackendSelector backend_selector_;
+  // guards `backend_selector_`, whose decisions are made and recorded by all
+  // threads that evaluate the function in `GENERATE_AUTO` mode
+  std::mutex backend_selector_mutex_;
+
+  std::size_t released_memory_{0};
+
+  // constructs the functor for `Scalar` from the stored constructor arguments
+  template <typename Scalar, typename Tuple>
+  static std::unique_ptr<Functor<Scalar>> make_functor(Tuple& args) {
+    return std::apply(
+        [](auto&... a) { return std::make_unique<Functor<Scalar>>(a...); },
+        args);
+  }
+
  public:
+  /**
+   * Constructs the functors for all scalar types from `args`. The arguments
+   * are copied (rvalues are moved) into this instance and kept to recreate
+   * the functors of the AD types after `release_traces()`. Every functor is
+   * constructed from lvalue references to these copies, so a functor that
+   * holds a reference to an argument refers to the copy owned by this
+   * instance, not to the caller's object. Wrap an argument in `std::ref` to
+   * share the caller's object instead.
+   */
   template <typename... Args>
   Generated(const std::string& name, Args&&... args) : name(name) {
-    f_double_ =
-        std::make_unique<Functor<BaseScalar>>(std::forward<Args>(args)...);
+    auto functor_args = std::make_shared<std::tuple<std::decay_t<Args>...>>(
+        std::forward<Args>(args)...);
+    make_f_cppad_ = [functor_args]() {
+      return make_functor<ADScalar>(*functor_args);
+    };
+    make_f_cg_ = [functor_args]() {
+      return make_functor<ADCGScalar>(*functor_args);
+    };
+    f_double_ = make_functor<BaseScalar>(*functor_args);
     gen_double_ = std::make_unique<GeneratedNumerical>(*f_double_);
-    f_cppad_ = std::make_unique<Functor<ADScalar>>(std::forward<Args>(args)...);
-    f_cg_ = std::make_unique<Functor<ADCGScalar>>(std::forward<Args>(args)...);
+    f_cppad_ = make_f_cppad_();
+    f_cg_ = make_f_cg_();
   }
 
   GenerationMode mode() const { return mode_; }
@@ -86,7 +338,8 @@ struct Generated {
     if (mode != this->mode_) {
       // changing the mode discards the previously compiled library
       discard_library();
-      if (this->mode_ == GENERATE_CPPAD) {
+      if ((this->mode_ == GENERATE_CPPAD || this->mode_ == GENERATE_AUTO) &&
+          gen_cppad_) {
         // make sure the old CppAD tape gets removed,
         // there can only be one at a time
         gen_cppad_->clear();
@@ -95,18 +348,253 @@ struct Generated {
     this->mode_ = mode;
   }
 
+  /**
+   * Selection of the backends in `GENERATE_AUTO` mode, which provides the log
+   * of its decisions.
+   */
+  BackendSelector& backend_selector() { return backend_selector_; }
+  const BackendSelector& backend_selector() const { return backend_selector_; }
+
+  /**
+   * Whether to sample hardware performance counters in the evaluation
+   * functions of the compiled CPU and CUDA code (see
+   * `GeneratedCodeGen::profile_performance`).
+   */
+  bool profile_performance() const { return profile_performance_; }
+  void set_profile_performance(bool profile) {
+    profile_performance_ = profile;
+    if (gen_cg_) {
+      gen_cg_->profile_performance = profile;
+    }
+  }
+  void print_performance_report(std::ostream& os = std::cout) const {
+    if (gen_cg_) {
+      gen_cg_->print_performance_report(os);
+    }
+  }
+
+  /**
+   * Whether the CPU code only contains the zero-order forward pass and the
+   * Jacobian is approximated by finite differences of the compiled function
+   * (see `GeneratedCodeGen::finite_difference_jacobian`). If
+   * `upgrade_in_background` is true, the exact Jacobian is compiled in a
+   * background thread and used once it is available.
+   */
+  bool finite_difference_jacobian() const {
+    return finite_difference_jacobian_;
+  }
+  void set_finite_difference_jacobian(bool enable,
+                                      bool upgrade_in_background = false) {
+    if (enable != finite_difference_jacobian_ ||
+        upgrade_in_background != upgrade_to_exact_jacobian_) {
+      discard_library();
+    }
+    finite_difference_jacobian_ = enable;
+    upgrade_to_exact_jacobian_ = upgrade_in_background;
+  }
+
+  /**
+   * Whether the CPU code of the Jacobian is compiled into a separate library
+   * at the first Jacobian evaluation, so that the forward pass is available
+   * as early as possible (see `GeneratedCodeGen::lazy_jacobian`). If
+   * `compile_in_background` is true, the Jacobian library is compiled in a
+   * background thread right after the forward library.
+   */
+  bool lazy_jacobian() const { return lazy_jacobian_; }
+  void set_lazy_jacobian(bool enable, bool compile_in_background = false) {
+    if (enable != lazy_jacobian_ ||
+        compile_in_background != background_jacobian_) {
+      discard_library();
+    }
+    lazy_jacobian_ = enable;
+    background_jacobian_ = compile_in_background;
+  }
+
+  /**
+   * Instruction set variants that the CPU code is additionally compiled for,
+   * of which the best one supported by the CPU is loaded (see
+   * `GeneratedCodeGen::isa_variants`).
+   */
+  const std::vector<IsaVariant>& isa_variants() const { return isa_variants_; }
+  void set_isa_variants(const std::vector<IsaVariant>& variants) {
+    discard_library();
+    isa_variants_ = variants;
+  }
+
+  /**
+   * Whether the first batched forward or Jacobian pass of a compiled library
+   * without tuned settings for that pass benchmarks them on its inputs (see
+   * `GeneratedCodeGen::autotune_on_first_use`).
+   */
+  bool autotune_on_first_use() const { return autotune_on_first_use_; }
+  void set_autotune_on_first_use(bool enable) {
+    autotune_on_first_use_ = enable;
+    if (gen_cg_) {
+      gen_cg_->autotune_on_first_use = enable;
+    }
+  }
+
+  /**
+   * Compiles the function if necessary, then benchmarks the thread counts
+   * and chunk sizes (CPU) or thread block sizes (CUDA) of the batched
+   * evaluations on `local_inputs` and saves the fastest settings next to the
+   * library (see `GeneratedCodeGen::autotune`).
+   */
+  TuningResult autotune(
+      const std::vector<std::vector<BaseScalar>>& local_inputs,
+      const std::vector<BaseScalar>& global_input = {}) {
+    if (mode_ != GENERATE_CPU && mode_ != GENERATE_CUDA) {
+      throw std::runtime_error("Only functions in GENERATE_CPU or "
+                               "GENERATE_CUDA mode can be tuned, \"" +
+                               name + "\" is in " + str(mode_) + " mode.");
+    }
+    std::vector<std::vector<BaseScalar>> outputs;
+    if (gen_cg_) {
+      gen_cg_->tuned_on_first_use_ = false;
+    }
+    (*this)(local_inputs, outputs, global_input);
+    // with `autotune_on_first_use`, this evaluation has already tuned the
+    // forward pass on the same inputs
+    return gen_cg_->autotune(local_inputs, global_input,
+                             !gen_cg_->tuned_on_first_use_, true);
+  }
+
+  /**
+   * Whether to compile the generated code for profiling and write a symbol
+   * map that relates the generated functions to the traced atomic functions
+   * (see `GeneratedCodeGen::annotate_sources`).
+   */
+  bool annotate_sources() const { return annotate_sources_; }
+  void set_annotate_sources(bool enable) {
+    if (enable != annotate_sources_) {
+      discard_library();
+    }
+    annotate_sources_ = enable;
+  }
+
+  /**
+   * Whether the Jacobian in `GENERATE_NONE` mode is computed via the
+   * complex-step method. Only this function instantiates the functor for
+   * `std::complex<BaseScalar>`, which is constructed from `args` when the
+   * method is enabled for the first time (the constructor arguments of this
+   * instance are not reused since they may be specific to the real-valued
+   * scalar types).
+   */
+  bool complex_step() const { return gen_double_->use_complex_step; }
+  template <typename... Args>
+  void set_complex_step(bool enable, Args&&... args) {
+    if (enable && !gen_double_->has_complex_functor()) {
+      gen_double_->set_complex_functor(
+          Functor<ComplexScalar>(std::forward<Args>(args)...));
+    }
+    gen_double_->use_complex_step = enable;
+  }
+
+  /**
+   * Whether the Jacobian in `GENERATE_CPPAD` mode is computed via CppAD's
+   * sparse Jacobian drivers with a cached sparsity pattern and coloring (see
+   * `GeneratedCppAD::use_sparse_jacobian`).
+   */
+  bool sparse_cppad_jacobian() const { return sparse_cppad_jacobian_; }
+  void set_sparse_cppad_jacobian(bool enable) {
+    sparse_cppad_jacobian_ = enable;
+    if (gen_cppad_) {
+      gen_cppad_->use_sparse_jacobian = enable;
+    }
+  }
+
   void discard_library() {
+    ready_ = nullptr;
+    backend_selector_.reset();
     if (gen_cg_) {
       // std::lock_guard<std::mutex> guard(compilation_mutex_);
       gen_cg_->discard_library();
     }
   }
+
+  /**
+   * Evaluates the function through the library at `path` that has been
+   * compiled for it before, e.g. in an earlier run or as a static library
+   * linked into the executable. If the function has not been traced yet, it
+   * is not traced: the library is used for the CPU (or for CUDA in
+   * `GENERATE_CUDA` mode) and the dimensions of a CPU library are taken from
+   * the library.
+   */
   void load_precompiled_library(const std::string& path) {
+    ready_ = nullptr;
+    backend_selector_.reset();
+    if (!gen_cg_) {
+      gen_cg_ = std::make_unique<GeneratedCodeGen>(name);
+      gen_cg_->set_target(mode_ == GENERATE_CUDA ? TARGET_CUDA : TARGET_CPU);
+      gen_cg_->global_input_dim_ = global_input_dim_;
+      apply_codegen_settings();
+    }
+    gen_cg_->load_precompiled_library(path);
+    if (gen_cg_->output_dim() > 0) {
+      local_input_dim_ = gen_cg_->local_input_dim();
+      output_dim_ = gen_cg_->output_dim();
+    }
+  }
+
+  /**
+   * Writes the traced function to a self-contained C++ header for
+   * ahead-of-time compilation into an application (see
+   * `GeneratedCodeGen::export_header`).
+   */
+  void export_header(const std::string& filename, const std::string& ns = "") {
+    if (!gen_cg_ || !gen_cg_->has_traces()) {
+      throw std::runtime_error(
+          "\"" + name +
+          "\" needs to be traced in GENERATE_CPU or GENERATE_CUDA mode "
+          "before it can be exported.");
+    }
+    gen_cg_->export_header(filename, ns);
+  }
+
+  /**
+   * Compiles the traced function to a static CPU library for linking into an
+   * executable and returns the path of the archive (see
+   * `GeneratedCodeGen::compile_static_library`).
+   */
+  std::string compile_static_library(const std::string& library_name = "") {
+    if (!gen_cg_ || !gen_cg_->has_traces()) {
+      throw std::runtime_error(
+          "\"" + name +
+          "\" needs to be traced in GENERATE_CPU or GENERATE_CUDA mode "
+          "before it can be compiled to a static library.");
+    }
+    return gen_cg_->compile_static_library(library_name);
+  }
+
+  /**
+   * Frees the functor instances for the AD types, the tapes, and the traces
+   * of all atomic functions. The compiled library remains loaded.
+   * Returns the resident memory that has been freed in bytes (0 if it cannot
+   * be measured on this platform).
+   */
+  std::size_t release_traces() {
+    const std::size_t memory_before = resident_memory();
+    f_cppad_.reset();
+    f_cg_.reset();
     if (gen_cg_) {
-      gen_cg_->load_precompiled_library(path);
+      gen_cg_->release_traces();
     }
+    CodeGenData<BaseScalar>::release(name);
+    trim_heap();
+    const std::size_t memory_after = resident_memory();
+    released_memory_ =
+        memory_before > memory_after ? memory_before - memory_after : 0;
+    std::cout << "Released traces of \"" << name << "\", freed "
+              << released_memory_ / 1024 << " KiB of resident memory.\n";
+    return released_memory_;
   }
 
+  /**
+   * Resident memory in bytes that has been freed by the last call to
+   * `release_traces()`.
+   */
+  std::size_t released_memory() const { return released_memory_; }
+
   AccumulationMethod jacobian_acc_method() const {
     return this->jac_acc_method_;
   }
@@ -125,17 +613,45 @@ struct Generated {
   bool debug_mode() const { return debug_mode_; }
   void set_debug_mode(bool debug_mode = true) { debug_mode_ = debug_mode; }
 
+  /**
+   * Groups of output indices that are computed by the same expression
+   * pattern, which enables loop detection in the generated code (see
+   * `GeneratedCodeGen::related_dependents`).
+   */
+  const std::vector<std::set<std::size_t>>& related_dependents() const {
+    return related_dependents_;
+  }
+  void set_related_dependents(
+      const std::vector<std::set<std::size_t>>& related_dependents) {
+    if (related_dependents != related_dependents_) {
+      discard_library();
+    }
+    related_dependents_ = related_dependents;
+  }
+
   int global_input_dim() const { return global_input_dim_; }
+  /**
+   * Changes how many of the inputs are shared across a batch. This does not
+   * require recompilation for CPU code; CUDA libraries are compiled once per
+   * split and reused afterwards (see `GeneratedCodeGen::set_global_input_dim`).
+   */
   void set_global_input_dim(int global_input_dim) {
     if (global_input_dim != global_input_dim_) {
-      // discard_library();
+      ready_ = nullptr;
+    }
+    if (gen_cg_ && gen_cg_->input_dim() > 0) {
+      gen_cg_->set_global_input_dim(global_input_dim);
+      local_input_dim_ = gen_cg_->local_input_dim();
     }
     global_input_dim_ = global_input_dim;
   }
 
-  bool is_compiled() const {
-    switch (mode_) {
+  bool is_compiled() const { return is_compiled(mode_); }
+
+  bool is_compiled(GenerationMode mode) const {
+    switch (mode) {
       case GENERATE_NONE:
+      case GENERATE_AUTO:
         return true;
       case GENERATE_CPPAD:
         return (bool)gen_cppad_;
@@ -151,17 +667,43 @@ struct Generated {
     return is_compiling_;
   }
 
+  /**
+   * Whether the function is compiled for the current settings, in which case
+   * the evaluation functions dispatch directly to the backend.
+   */
+  bool is_ready() const { return ready_ != nullptr; }
+
   void operator()(const std::vector<BaseScalar>& input,
                   std::vector<BaseScalar>& output) {
-    conditionally_compile(input, output);
+    if (mode_ == GENERATE_AUTO) {
+      evaluate_auto("forward", false, 1, [&](GenerationMode mode) {
+        conditionally_compile(input, output, mode);
+        backend(mode)(input, output);
+      });
+      return;
+    }
+    if (ready_) {
+      (*ready_)(input, output);
+      return;
+    }
+    conditionally_compile(input, output, mode_);
+    prepare()(input, output);
+  }
 
-    if (mode_ == GENERATE_NONE) {
-      (*gen_double_)(input, output);
-    } else if (mode_ == GENERATE_CPPAD) {
-      (*gen_cppad_)(input, output);
-    } else {
-      (*gen_cg_)(input, output);
+  /**
+   * Forward pass on raw buffers of `input_dim()` and `output_dim()` entries.
+   * The function needs to have been evaluated on vectors before, so that its
+   * dimensions are known.
+   */
+  void operator()(const BaseScalar* input, BaseScalar* output) {
+    if (ready_) {
+      (*ready_)(input, output);
+      return;
     }
+    std::vector<BaseScalar> input_vec(input, input + checked_input_dim());
+    std::vector<BaseScalar> output_vec(output_dim());
+    (*this)(input_vec, output_vec);
+    std::copy(output_vec.begin(), output_vec.end(), output);
   }
 
   /**
@@ -174,75 +716,394 @@ struct Generated {
     if (local_inputs.empty()) {
       return;
     }
+    if (mode_ == GENERATE_AUTO) {
+      evaluate_auto("forward_batch", false, local_inputs.size(),
+                    [&](GenerationMode mode) {
+                      outputs.resize(local_inputs.size());
+                      conditionally_compile(local_inputs, outputs,
+                                            global_input, mode);
+                      backend(mode)(local_inputs, outputs, global_input);
+                    });
+      return;
+    }
     outputs.resize(local_inputs.size());
+    if (is_ready(global_input)) {
+      (*ready_)(local_inputs, outputs, global_input);
+      return;
+    }
+    conditionally_compile(local_inputs, outputs, global_input, mode_);
+    prepare()(local_inputs, outputs, global_input);
+  }
 
-    conditionally_compile(local_inputs, outputs, global_input);
-
-    if (mode_ == GENERATE_NONE) {
-      (*gen_double_)(local_inputs, outputs, global_input);
-    } else if (mode_ == GENERATE_CPPAD) {
-      (*gen_cppad_)(local_inputs, outputs, global_input);
-    } else {
-      (*gen_cg_)(local_inputs, outputs, global_input);
+  /**
+   * Vectorized execution of the forward pass over groups of local inputs,
+   * where each group carries its own global input. All groups are evaluated
+   * within a single parallel dispatch.
+   */
+  void operator()(const std::vector<InputGroup>& groups,
+                  GroupedOutputs& outputs) {
+    if (mode_ == GENERATE_AUTO) {
+      evaluate_auto("forward_grouped", false, num_samples(groups),
+                    [&](GenerationMode mode) {
+                      if (conditionally_compile(groups, outputs, mode)) {
+                        backend(mode)(groups, outputs);
+                      }
+                    });
+      return;
+    }
+    if (is_ready(groups)) {
+      (*ready_)(groups, outputs);
+      return;
+    }
+    if (!conditionally_compile(groups, outputs, mode_)) {
+      return;
     }
+    prepare()(groups, outputs);
   }
 
   void jacobian(const std::vector<BaseScalar>& input,
                 std::vector<BaseScalar>& output) {
-    conditionally_compile(input, output);
-    if (mode_ == GENERATE_NONE) {
-      gen_double_->jacobian(input, output);
+    if (mode_ == GENERATE_AUTO) {
+      evaluate_auto("jacobian", true, 1, [&](GenerationMode mode) {
+        conditionally_compile(input, output, mode);
+        backend(mode).jacobian(input, output);
+      });
       return;
     }
-    if (mode_ == GENERATE_CPPAD) {
-      gen_cppad_->jacobian(input, output);
+    if (ready_) {
+      ready_->jacobian(input, output);
       return;
     }
+    conditionally_compile(input, output, mode_);
+    prepare().jacobian(input, output);
+  }
 
-    gen_cg_->jacobian(input, output);
+  /**
+   * Row-major Jacobian on raw buffers of `input_dim()` and `input_dim() *
+   * output_dim()` entries (see the raw-buffer forward pass).
+   */
+  void jacobian(const BaseScalar* input, BaseScalar* output) {
+    if (ready_) {
+      ready_->jacobian(input, output);
+      return;
+    }
+    std::vector<BaseScalar> input_vec(input, input + checked_input_dim());
+    std::vector<BaseScalar> output_vec;
+    jacobian(input_vec, output_vec);
+    std::copy(output_vec.begin(), output_vec.end(), output);
   }
 
   void jacobian(const std::vector<std::vector<BaseScalar>>& local_inputs,
                 std::vector<std::vector<BaseScalar>>& outputs,
                 const std::vector<BaseScalar>& global_input = {}) {
     outputs.resize(local_inputs.size());
-    conditionally_compile(local_inputs, outputs, global_input);
-    if (mode_ == GENERATE_NONE) {
-      gen_double_->jacobian(local_inputs, outputs, global_input);
+    if (mode_ == GENERATE_AUTO && !local_inputs.empty()) {
+      evaluate_auto("jacobian_batch", true, local_inputs.size(),
+                    [&](GenerationMode mode) {
+                      conditionally_compile(local_inputs, outputs,
+                                            global_input, mode);
+                      backend(mode).jacobian(local_inputs, outputs,
+                                             global_input);
+                    });
+      return;
+    }
+    if (is_ready(global_input)) {
+      ready_->jacobian(local_inputs, outputs, global_input);
       return;
     }
-    if (mode_ == GENERATE_CPPAD) {
-      gen_cppad_->jacobian(local_inputs, outputs, global_input);
+    if (local_inputs.empty()) {
       return;
     }
+    conditionally_compile(local_inputs, outputs, global_input, mode_);
+    prepare().jacobian(local_inputs, outputs, global_input);
+  }
 
-    gen_cg_->jacobian(local_inputs, outputs, global_input);
+  /**
+   * Vectorized forward pass on flat buffers of `num_samples` local inputs and
+   * outputs arranged in `layout` (AoS, SoA or interleaved, see
+   * `BatchLayout`). Compiled CPU functions read and write the buffers
+   * directly, without converting the batch to vectors. The function needs to
+   * have been evaluated on vectors before, so that its dimensions are known.
+   */
+  void forward_batch(std::size_t num_samples, const BaseScalar* local_inputs,
+                     BaseScalar* outputs, const BatchLayout& layout = {},
+                     const std::vector<BaseScalar>& global_input = {}) {
+    if (num_samples == 0) {
+      return;
+    }
+    if (is_ready(global_input)) {
+      ready_->forward_batch(num_samples, local_inputs, outputs, layout,
+                            global_input);
+      return;
+    }
+    std::vector<std::vector<BaseScalar>> inputs, results;
+    gather_batch(num_samples, checked_input_dim() - global_input.size(),
+                 local_inputs, layout, inputs);
+    (*this)(inputs, results, global_input);
+    scatter_batch(results, outputs, layout);
+  }
+
+  /**
+   * Vectorized Jacobian pass on flat buffers (see `forward_batch`), where
+   * `jacobians` receives the Jacobians (`output_dim()` x `input_dim()`) of
+   * the samples in row- or column-major order.
+   */
+  void jacobian_batch(std::size_t num_samples, const BaseScalar* local_inputs,
+                      BaseScalar* jacobians, const BatchLayout& layout = {},
+                      MatrixOrder order = ROW_MAJOR,
+                      const std::vector<BaseScalar>& global_input = {}) {
+    if (num_samples == 0) {
+      return;
+    }
+    if (is_ready(global_input)) {
+      ready_->jacobian_batch(num_samples, local_inputs, jacobians, layout,
+                             order, global_input);
+      return;
+    }
+    std::vector<std::vector<BaseScalar>> inputs, results;
+    gather_batch(num_samples, checked_input_dim() - global_input.size(),
+                 local_inputs, layout, inputs);
+    jacobian(inputs, results, global_input);
+    scatter_batch(results, jacobians, layout,
+                  jacobian_positions(output_dim(), input_dim(), order));
+  }
+
+  void jacobian(const std::vector<InputGroup>& groups,
+                GroupedOutputs& outputs) {
+    if (mode_ == GENERATE_AUTO) {
+      evaluate_auto("jacobian_grouped", true, num_samples(groups),
+                    [&](GenerationMode mode) {
+                      if (conditionally_compile(groups, outputs, mode)) {
+                        backend(mode).jacobian(groups, outputs);
+                      }
+                    });
+      return;
+    }
+    if (is_ready(groups)) {
+      ready_->jacobian(groups, outputs);
+      return;
+    }
+    if (!conditionally_compile(groups, outputs, mode_)) {
+      return;
+    }
+    prepare().jacobian(groups, outputs);
+  }
+
+  /**
+   * Rolls out the function as a step function x_{t+1} = f(params, x_t) for
+   * `num_steps` steps, where `params` is the global input and the state is
+   * the local input. If `trajectory` is not null, it receives the state after
+   * each step.
+   */
+  void rollout(const std::vector<BaseScalar>& x0,
+               const std::vector<BaseScalar>& params, int num_steps,
+               std::vector<BaseScalar>& final_state,
+               std::vector<std::vector<BaseScalar>>* trajectory = nullptr) {
+    check_num_steps(num_steps);
+    if (mode_ == GENERATE_AUTO) {
+      evaluate_auto("rollout", false, std::max(num_steps, 1),
+                    [&](GenerationMode mode) {
+                      conditionally_compile_rollout(x0, params, mode);
+                      backend(mode).rollout(x0, params, num_steps, final_state,
+                                            trajectory);
+                    });
+      return;
+    }
+    if (is_ready(params)) {
+      ready_->rollout(x0, params, num_steps, final_state, trajectory);
+      return;
+    }
+    conditionally_compile_rollout(x0, params, mode_);
+    prepare().rollout(x0, params, num_steps, final_state, trajectory);
+  }
+
+  /**
+   * Rolls out the step function from multiple initial states in parallel.
+   */
+  void rollout(const std::vector<std::vector<BaseScalar>>& x0s,
+               const std::vector<BaseScalar>& params, int num_steps,
+               std::vector<std::vector<BaseScalar>>& final_states,
+               std::vector<std::vector<std::vector<BaseScalar>>>* trajectories =
+                   nullptr) {
+    check_num_steps(num_steps);
+    if (x0s.empty()) {
+      return;
+    }
+    if (mode_ == GENERATE_AUTO) {
+      evaluate_auto("rollout_batch", false,
+                    x0s.size() * std::max(num_steps, 1),
+                    [&](GenerationMode mode) {
+                      conditionally_compile_rollout(x0s[0], params, mode);
+                      backend(mode).rollout(x0s, params, num_steps,
+                                            final_states, trajectories);
+                    });
+      return;
+    }
+    if (is_ready(params)) {
+      ready_->rollout(x0s, params, num_steps, final_states, trajectories);
+      return;
+    }
+    conditionally_compile_rollout(x0s[0], params, mode_);
+    prepare().rollout(x0s, params, num_steps, final_states, trajectories);
   }
 
  protected:
-  void compile(const FunctionTrace<BaseScalar>& main_trace) {
+  // whether calls with the given global input can be dispatched directly
+  bool is_ready(const std::vector<BaseScalar>& global_input) const {
+    return ready_ && static_cast<int>(global_input.size()) == global_input_dim_;
+  }
+  bool is_ready(const std::vector<InputGroup>& groups) const {
+    // the groups are only checked for a consistent split when compiling
+    return ready_ && !groups.empty() &&
+           static_cast<int>(groups[0].global_input.size()) == global_input_dim_;
+  }
+
+  static std::size_t num_samples(const std::vector<InputGroup>& groups) {
+    std::size_t n = 0;
+    for (const auto& group : groups) {
+      n += group.local_inputs.size();
+    }
+    return n;
+  }
+
+  /**
+   * Runs `eval` in the mode chosen by the backend selector and records its
+   * duration (`GENERATE_AUTO` mode).
+   */
+  template <typename Eval>
+  void evaluate_auto(const char* entry_point, bool jacobian,
+                     std::size_t num_samples, Eval eval) {
+    const bool cpu_compiled = gen_cg_ && gen_cg_->is_compiled();
+    BackendDecision decision;
+    {
+      std::lock_guard<std::mutex> lock(backend_selector_mutex_);
+      decision = backend_selector_.select(entry_point, jacobian, num_samples,
+                                          cpu_compiled);
+    }
+    const bool prepared = !is_compiled(decision.mode);
+    const auto start = std::chrono::steady_clock::now();
+    try {
+      eval(decision.mode);
+    } catch (const std::exception& e) {
+      if (decision.mode != GENERATE_CPU || cpu_compiled) {
+        throw;
+      }
+      std::cerr << "Failed to compile \"" << name
+                << "\", continuing without compiled code: " << e.what()
+                << "\n";
+      {
+        std::lock_guard<std::mutex> lock(backend_selector_mutex_);
+        backend_selector_.allow_compilation = false;
+      }
+      evaluate_auto(entry_point, jacobian, num_samples, eval);
+      return;
+    }
+    const double elapsed = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    std::lock_guard<std::mutex> lock(backend_selector_mutex_);
+    backend_selector_.record(decision, elapsed, jacobian, prepared);
+  }
+
+  int checked_input_dim() const {
+    if (input_dim() == 0 || output_dim() == 0) {
+      throw std::runtime_error(
+          "The dimensions of \"" + name +
+          "\" are unknown. Evaluate it on std::vector arguments before "
+          "passing raw pointers.");
+    }
+    return input_dim();
+  }
+
+  /**
+   * Returns the backend to evaluate the function after `conditionally_compile`
+   * and enters the ready state if the function has been compiled.
+   */
+  GeneratedBase& prepare() {
+    GeneratedBase& target = backend(mode_);
+    if (is_compiled() && !is_compiling_) {
+      ready_ = &target;
+    }
+    return target;
+  }
+
+  GeneratedBase& backend(GenerationMode mode) {
+    if (mode == GENERATE_NONE) {
+      return *gen_double_;
+    } else if (mode == GENERATE_CPPAD) {
+      return *gen_cppad_;
+    }
+    return *gen_cg_;
+  }
+
+  // passes the settings of this function on to a new `gen_cg_`
+  void apply_codegen_settings() {
+    gen_cg_->debug_mode = debug_mode_;
+    gen_cg_->related_dependents = related_dependents_;
+    gen_cg_->profile_performance = profile_performance_;
+    gen_cg_->finite_difference_jacobian = finite_difference_jacobian_;
+    gen_cg_->upgrade_to_exact_jacobian = upgrade_to_exact_jacobian_;
+    gen_cg_->lazy_jacobian = lazy_jacobian_;
+    gen_cg_->background_jacobian = background_jacobian_;
+    gen_cg_->annotate_sources = annotate_sources_;
+    gen_cg_->autotune_on_first_use = autotune_on_first_use_;
+    gen_cg_->isa_variants = isa_variants_;
+  }
+
+  // compiles the traced function for `mode` (GENERATE_CPU or GENERATE_CUDA)
+  void compile(const FunctionTrace<BaseScalar>& main_trace,
+               GenerationMode mode) {
     {
       // std::lock_guard<std::mutex> guard(compilation_mutex_);
       is_compiling_ = true;
     }
 
+    // the traced input is the concatenation of the global and local inputs
+    local_input_dim_ =
+        static_cast<int>(main_trace.tape->Domain()) - global_input_dim_;
     gen_cg_->local_input_dim_ = this->local_input_dim_;
     gen_cg_->global_input_dim_ = this->global_input_dim_;
     gen_cg_->output_dim_ = this->output_dim_;
-    if (mode_ == GENERATE_CPU) {
+    {
+      // the measured costs refer to the previously compiled code
+      std::lock_guard<std::mutex> lock(backend_selector_mutex_);
+      backend_selector_.reset();
+    }
+    if (mode == GENERATE_CPU) {
       gen_cg_->compile_cpu();
-    } else if (mode_ == GENERATE_CUDA) {
+    } else if (mode == GENERATE_CUDA) {
       gen_cg_->compile_cuda();
     }
 
+    if (release_traces_after_compile) {
+      // load the library first so that the tracing state is no longer needed
+      if (mode == GENERATE_CPU) {
+        gen_cg_->get_cpu_model();
+      } else if (mode == GENERATE_CUDA) {
+        gen_cg_->get_cuda_model();
+      }
+      if (mode == GENERATE_CPU && gen_cg_->jacobian_needs_traces()) {
+        // the exact Jacobian is compiled from the traces later
+        gen_cg_->release_traces_after_jacobian = true;
+      } else {
+        release_traces();
+      }
+    }
+
     {
       // std::lock_guard<std::mutex> guard(compilation_mutex_);
       is_compiling_ = false;
     }
   }
 
+  /**
+   * Traces and compiles the function for `mode` (the current mode, or the
+   * backend chosen for a call in `GENERATE_AUTO` mode) unless this has
+   * happened before.
+   */
   void conditionally_compile(const std::vector<BaseScalar>& input,
-                             std::vector<BaseScalar>& output) {
+                             std::vector<BaseScalar>& output,
+                             GenerationMode mode) {
     if (input_dim() == 0 || output_dim() == 0) {
       // retrieve dimensions by evaluating double-instantiated functor on
       // provided input
@@ -250,10 +1111,10 @@ struct Generated {
       local_input_dim_ = input.size();
       output_dim_ = output.size();
     }
-    if (is_compiled()) {
+    if (is_compiled(mode)) {
       return;
     }
-    if (mode_ == GENERATE_CPPAD) {
+    if (mode == GENERATE_CPPAD) {
       std::vector<CppAD::AD<BaseScalar>> ax_, ay_;
       ax_.resize(input.size());
       ay_.resize(output.size());
@@ -261,25 +1122,41 @@ struct Generated {
         ax_[i] = ADScalar(input[i]);
       }
       CppAD::Independent(ax_);
+      if (!f_cppad_) {
+        f_cppad_ = make_f_cppad_();
+      }
       (*f_cppad_)(ax_, ay_);
       gen_cppad_ = std::make_unique<GeneratedCppAD>(
           std::make_shared<CppAD::ADFun<BaseScalar>>(ax_, ay_));
+      gen_cppad_->use_sparse_jacobian = sparse_cppad_jacobian_;
       return;
     }
-    if (mode_ == GENERATE_CPU || mode_ == GENERATE_CUDA) {
+    if (mode == GENERATE_CPU || mode == GENERATE_CUDA) {
       // std::lock_guard<std::mutex> guard(compilation_mutex_);
 
       assert(!input.empty());
       assert(!output.empty());
-      FunctionTrace<BaseScalar> t = autogen::trace(*f_cg_, name, input, output);
+      if (!f_cg_) {
+        f_cg_ = make_f_cg_();
+      }
+      // only the CUDA kernels evaluate mapped atomics in a loop
+      FunctionTrace<BaseScalar> t =
+          autogen::trace(*f_cg_, name, input, output, num_trace_threads,
+                         mode == GENERATE_CUDA);
+      std::unique_ptr<GeneratedCodeGen> previous = std::move(gen_cg_);
       gen_cg_ = std::make_unique<GeneratedCodeGen>(t);
-      gen_cg_->debug_mode = debug_mode_;
+      if (previous) {
+        // CUDA libraries compiled for other global input dimensions remain
+        // valid since the function has not changed
+        gen_cg_->cuda_libraries_ = std::move(previous->cuda_libraries_);
+      }
+      apply_codegen_settings();
       if (compile_in_background) {
-        std::thread worker([this, &t]() { compile(t); });
+        std::thread worker([this, &t, mode]() { compile(t, mode); });
         (*f_double_)(input, output);
         return;
       } else {
-        compile(t);
+        compile(t, mode);
         std::cout << "Finished compilation.\n";
       }
     }
@@ -288,16 +1165,47 @@ struct Generated {
   void conditionally_compile(
       const std::vector<std::vector<BaseScalar>>& local_inputs,
       std::vector<std::vector<BaseScalar>>& outputs,
-      const std::vector<BaseScalar>& global_input) {
-    global_input_dim_ = global_input.size();
-    std::vector<BaseScalar> compilation_input;
-    compilation_input.insert(compilation_input.end(), global_input.begin(),
-                             global_input.end());
-    compilation_input.insert(compilation_input.end(), local_inputs[0].begin(),
-                             local_inputs[0].end());
-    conditionally_compile(compilation_input, outputs[0]);
+      const std::vector<BaseScalar>& global_input, GenerationMode mode) {
+    set_global_input_dim(static_cast<int>(global_input.size()));
+    if (!is_compiled(mode)) {
+      std::vector<BaseScalar> compilation_input;
+      compilation_input.insert(compilation_input.end(), global_input.begin(),
+                               global_input.end());
+      compilation_input.insert(compilation_input.end(),
+                               local_inputs[0].begin(), local_inputs[0].end());
+      conditionally_compile(compilation_input, outputs[0], mode);
+    }
     local_input_dim_ = local_inputs[0].size();
   }
+
+  /**
+   * Compiles the function based on the first non-empty group.
+   * Returns false if none of the groups contains any local inputs.
+   */
+  bool conditionally_compile(const std::vector<InputGroup>& groups,
+                             GroupedOutputs& outputs, GenerationMode mode) {
+    outputs.resize(groups.size());
+    for (size_t g = 0; g < groups.size(); ++g) {
+      if (groups[g].local_inputs.empty()) {
+        continue;
+      }
+      outputs[g].resize(groups[g].local_inputs.size());
+      conditionally_compile(groups[g].local_inputs, outputs[g],
+                            groups[g].global_input, mode);
+      return true;
+    }
+    return false;
+  }
+
+  // compiles the step function of a rollout from `x0`, which it maps to the
+  // next state of equal dimension
+  void conditionally_compile_rollout(const std::vector<BaseScalar>& x0,
+                                     const std::vector<BaseScalar>& params,
+                                     GenerationMode mode) {
+    std::vector<std::vector<BaseScalar>> outputs(
+        1, std::vector<BaseScalar>(x0.size()));
+    conditionally_compile({x0}, outputs, params, mode);
+  }
 };
 
 }  // namespace autogen
\ No newline at end of file
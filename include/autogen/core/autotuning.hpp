@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace autogen {
+/**
+ * Parallelization settings of a batched evaluation function.
+ */
+struct TuningConfig {
+  // number of OpenMP threads (0 uses the OpenMP default)
+  int num_threads{0};
+  // number of samples per chunk, the chunks are assigned to the threads in
+  // round-robin order (0 assigns one contiguous range of samples per thread)
+  int chunk_size{0};
+  // number of CUDA threads per block (0 uses `num_gpu_threads_per_block`)
+  int gpu_threads_per_block{0};
+
+  static int max_threads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+
+  int threads() const { return num_threads > 0 ? num_threads : max_threads(); }
+
+  int chunk(int num_samples) const {
+    if (chunk_size > 0) {
+      return chunk_size;
+    }
+    return std::max(1, (num_samples + threads() - 1) / threads());
+  }
+};
+
+/**
+ * Tuned settings of the batched forward and Jacobian passes of a compiled
+ * library.
+ */
+struct TuningResult {
+  TuningConfig forward;
+  TuningConfig jacobian;
+  // whether the settings of the forward and Jacobian passes have been tuned,
+  // only tuned settings are written to the tuning file
+  bool forward_tuned{false};
+  bool jacobian_tuned{false};
+
+  /**
+   * Reads the settings from `filename`. Returns false if the file does not
+   * exist or has been written on a machine with a different number of
+   * hardware threads.
+   */
+  bool load(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file) {
+      return false;
+    }
+    TuningResult result;
+    std::string line;
+    while (std::getline(file, line)) {
+      std::istringstream stream(line);
+      std::string key;
+      if (!(stream >> key) || key[0] == '#') {
+        continue;
+      }
+      if (key == "hardware_threads") {
+        unsigned int hardware_threads = 0;
+        stream >> hardware_threads;
+        if (hardware_threads != std::thread::hardware_concurrency()) {
+          std::cout << "Ignoring tuning file " << filename
+                    << " that was written for " << hardware_threads
+                    << " hardware threads.\n";
+          return false;
+        }
+      } else if (key == "forward" || key == "jacobian") {
+        TuningConfig &config =
+            key == "forward" ? result.forward : result.jacobian;
+        if (stream >> config.num_threads >> config.chunk_size >>
+            config.gpu_threads_per_block) {
+          (key == "forward" ? result.forward_tuned : result.jacobian_tuned) =
+              true;
+        }
+      }
+    }
+    *this = result;
+    return true;
+  }
+
+  void save(const std::string &filename, const std::string &comment) const {
+    std::ofstream file(filename);
+    if (!file) {
+      throw std::runtime_error("Could not write tuning file \"" + filename +
+                               "\".");
+    }
+    file << "# " << comment << "\n";
+    file << "# <entry point> <threads> <chunk size> <GPU threads per block>\n";
+    file << "hardware_threads " << std::thread::hardware_concurrency() << "\n";
+    if (forward_tuned) {
+      file << "forward " << forward.num_threads << " " << forward.chunk_size
+           << " " << forward.gpu_threads_per_block << "\n";
+    }
+    if (jacobian_tuned) {
+      file << "jacobian " << jacobian.num_threads << " " << jacobian.chunk_size
+           << " " << jacobian.gpu_threads_per_block << "\n";
+    }
+  }
+};
+
+/**
+ * Configurations the autotuner benchmarks for a batch of `num_samples` CPU
+ * evaluations: powers of two up to the maximum number of threads, each with
+ * contiguous ranges and with round-robin chunks of several sizes.
+ */
+inline std::vector<TuningConfig> cpu_tuning_candidates(int num_samples) {
+  const int max_threads = TuningConfig::max_threads();
+  std::vector<int> thread_counts;
+  for (int t = 1; t < max_threads; t *= 2) {
+    thread_counts.push_back(t);
+  }
+  thread_counts.push_back(max_threads);
+  std::vector<TuningConfig> candidates;
+  for (int threads : thread_counts) {
+    const int range = (num_samples + threads - 1) / threads;
+    for (int chunk : {0, 1, 8, 64}) {
+      if (chunk == 0 || (threads > 1 && chunk < range)) {
+        candidates.push_back({threads, chunk, 0});
+      }
+    }
+  }
+  return candidates;
+}
+
+/**
+ * Thread block sizes the autotuner benchmarks for a batch of `num_samples`
+ * CUDA evaluations.
+ */
+inline std::vector<TuningConfig> gpu_tuning_candidates(int num_samples) {
+  std::vector<TuningConfig> candidates;
+  for (int block_size : {32, 64, 128, 256, 512}) {
+    if (block_size == 32 || block_size <= num_samples) {
+      candidates.push_back({0, 0, block_size});
+    }
+  }
+  return candidates;
+}
+}  // namespace autogen
@@ -1,13 +1,57 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
+#include "batch_layout.hpp"
+
 namespace autogen {
 using BaseScalar = double;
 
 enum AccumulationMethod { ACCUMULATE_NONE, ACCUMULATE_SUM, ACCUMULATE_MEAN };
 
+/**
+ * Batch of local inputs that share the same global input.
+ */
+struct InputGroup {
+  std::vector<BaseScalar> global_input;
+  std::vector<std::vector<BaseScalar>> local_inputs;
+};
+
+/**
+ * Outputs of a grouped evaluation, indexed by group, then by local input.
+ */
+using GroupedOutputs = std::vector<std::vector<std::vector<BaseScalar>>>;
+
+/**
+ * Sparsity pattern of a matrix in compressed sparse row (CSR) format. The
+ * column indices of row `i` are stored at positions `row_offsets[i]` to
+ * `row_offsets[i + 1] - 1` of `col_indices`; the values of a matrix with this
+ * pattern are stored in the same order.
+ */
+struct CsrPattern {
+  std::size_t num_rows{0};
+  std::size_t num_cols{0};
+  std::vector<std::size_t> row_offsets;
+  std::vector<std::size_t> col_indices;
+
+  std::size_t nnz() const { return col_indices.size(); }
+};
+
+/**
+ * Throws `std::invalid_argument` if the number of rollout steps is negative.
+ */
+inline void check_num_steps(int num_steps) {
+  if (num_steps < 0) {
+    throw std::invalid_argument(
+        "The number of rollout steps must not be negative, but " +
+        std::to_string(num_steps) + " was provided.");
+  }
+}
+
 struct GeneratedBase {
  protected:
   int local_input_dim_{-1};
@@ -73,12 +117,117 @@ struct GeneratedBase {
     }
   }
 
+  /**
+   * Vectorized forward pass on flat buffers: `local_inputs` holds the local
+   * inputs of `num_samples` samples and `outputs` receives their outputs, both
+   * arranged in `layout` (see `BatchLayout::size()` for the buffer sizes).
+   * Only AoS buffers are evaluated without copies (see `BatchLayoutType`).
+   */
+  virtual void forward_batch(std::size_t num_samples,
+                             const BaseScalar *local_inputs,
+                             BaseScalar *outputs, const BatchLayout &layout,
+                             const std::vector<BaseScalar> &global_input) {
+    // if this function doesn't get overwritten we have to copy
+    std::vector<std::vector<BaseScalar>> inputs, results;
+    const std::size_t local_dim = input_dim() - global_input.size();
+    gather_batch(num_samples, local_dim, local_inputs, layout, inputs);
+    (*this)(inputs, results, global_input);
+    scatter_batch(results, outputs, layout);
+  }
+
+  /**
+   * Vectorized forward pass over multiple groups of local inputs, where each
+   * group is evaluated with its own global input.
+   */
+  virtual void operator()(const std::vector<InputGroup> &groups,
+                          GroupedOutputs &outputs) {
+    // if this function doesn't get overwritten we evaluate group by group
+    outputs.resize(groups.size());
+    for (size_t g = 0; g < groups.size(); ++g) {
+      (*this)(groups[g].local_inputs, outputs[g], groups[g].global_input);
+    }
+  }
+
+  /**
+   * Rollout of a step function x_{t+1} = f(params, x_t), where the parameters
+   * form the global input and the state forms the local input of the
+   * function. The output dimension has to match the state dimension.
+   * @param x0 Initial state.
+   * @param params Parameters that remain constant throughout the rollout.
+   * @param num_steps Number of times the step function is applied (must not
+   * be negative).
+   * @param final_state State after `num_steps` steps.
+   * @param trajectory If not null, receives the state after each step.
+   */
+  virtual void rollout(
+      const std::vector<BaseScalar> &x0, const std::vector<BaseScalar> &params,
+      int num_steps, std::vector<BaseScalar> &final_state,
+      std::vector<std::vector<BaseScalar>> *trajectory = nullptr) {
+    check_num_steps(num_steps);
+    const size_t pd = params.size();
+    const size_t sd = x0.size();
+    std::vector<BaseScalar> input(pd + sd), output(sd);
+    std::copy(params.begin(), params.end(), input.begin());
+    std::copy(x0.begin(), x0.end(), input.begin() + pd);
+    if (trajectory) {
+      trajectory->resize(num_steps);
+    }
+    for (int t = 0; t < num_steps; ++t) {
+      (*this)(input, output);
+      if (output.size() != sd) {
+        throw std::runtime_error(
+            "Rollout requires the output dimension (" +
+            std::to_string(output.size()) +
+            ") to match the dimension of the state (" + std::to_string(sd) +
+            ").");
+      }
+      if (trajectory) {
+        (*trajectory)[t] = output;
+      }
+      std::copy(output.begin(), output.end(), input.begin() + pd);
+    }
+    final_state.assign(input.begin() + pd, input.end());
+  }
+
+  /**
+   * Vectorized rollout of the step function from multiple initial states that
+   * share the same parameters.
+   */
+  virtual void rollout(
+      const std::vector<std::vector<BaseScalar>> &x0s,
+      const std::vector<BaseScalar> &params, int num_steps,
+      std::vector<std::vector<BaseScalar>> &final_states,
+      std::vector<std::vector<std::vector<BaseScalar>>> *trajectories =
+          nullptr) {
+    check_num_steps(num_steps);
+    final_states.resize(x0s.size());
+    if (trajectories) {
+      trajectories->resize(x0s.size());
+    }
+    for (size_t i = 0; i < x0s.size(); ++i) {
+      rollout(x0s[i], params, num_steps, final_states[i],
+              trajectories ? &(*trajectories)[i] : nullptr);
+    }
+  }
+
   /**
    * Jacobian pass.
    */
   virtual void jacobian(const std::vector<BaseScalar> &input,
                         std::vector<BaseScalar> &output) = 0;
 
+  /**
+   * Jacobian pass on raw buffers, where `output` receives the row-major
+   * Jacobian (output dimension x input dimension).
+   */
+  virtual void jacobian(const BaseScalar *input, BaseScalar *output) {
+    // if this function doesn't get overwritten we have to copy
+    std::vector<BaseScalar> input_vec(input, input + input_dim());
+    std::vector<BaseScalar> output_vec(input_dim() * output_dim());
+    jacobian(input_vec, output_vec);
+    std::copy(output_vec.begin(), output_vec.end(), output);
+  }
+
   /**
    * Vectorized version of Jacobian pass.
    */
@@ -86,5 +235,36 @@ struct GeneratedBase {
       const std::vector<std::vector<BaseScalar>> &local_inputs,
       std::vector<std::vector<BaseScalar>> &outputs,
       const std::vector<BaseScalar> &global_input = {}) = 0;
+
+  /**
+   * Vectorized Jacobian pass on flat buffers, where `jacobians` receives the
+   * Jacobians (output dimension x input dimension) of the samples in the
+   * given storage order, arranged in `layout` (see `forward_batch`).
+   */
+  virtual void jacobian_batch(std::size_t num_samples,
+                              const BaseScalar *local_inputs,
+                              BaseScalar *jacobians, const BatchLayout &layout,
+                              MatrixOrder order,
+                              const std::vector<BaseScalar> &global_input) {
+    // if this function doesn't get overwritten we have to copy
+    std::vector<std::vector<BaseScalar>> inputs, results;
+    const std::size_t local_dim = input_dim() - global_input.size();
+    gather_batch(num_samples, local_dim, local_inputs, layout, inputs);
+    jacobian(inputs, results, global_input);
+    scatter_batch(results, jacobians, layout,
+                  jacobian_positions(output_dim(), input_dim(), order));
+  }
+
+  /**
+   * Vectorized Jacobian pass over multiple groups of local inputs, where each
+   * group is evaluated with its own global input.
+   */
+  virtual void jacobian(const std::vector<InputGroup> &groups,
+                        GroupedOutputs &outputs) {
+    outputs.resize(groups.size());
+    for (size_t g = 0; g < groups.size(); ++g) {
+      jacobian(groups[g].local_inputs, outputs[g], groups[g].global_input);
+    }
+  }
 };
 }  // namespace autogen
\ No newline at end of file
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#ifdef USE_EIGEN
+#include <Eigen/Core>
+#endif
+
+namespace autogen {
+/**
+ * Arrangement of a batch of vectors (the inputs, outputs or Jacobians of the
+ * samples of a batch) in a flat buffer. The generated code always evaluates
+ * contiguous vectors and row-major Jacobians, so only AoS buffers (with
+ * row-major Jacobians) are passed to compiled CPU functions without copies;
+ * the samples of the other layouts and of column-major Jacobians are copied
+ * one at a time (see `gather_batch` and `scatter_sample`).
+ */
+enum BatchLayoutType {
+  // array of structures: the vectors are stored one after another
+  LAYOUT_AOS,
+  // structure of arrays: entry 0 of all vectors, then entry 1, etc.
+  LAYOUT_SOA,
+  // blocks of `lanes` consecutive vectors, each block in SoA layout
+  LAYOUT_INTERLEAVED
+};
+
+/**
+ * Storage order of the Jacobian of a sample.
+ */
+enum MatrixOrder { ROW_MAJOR, COLUMN_MAJOR };
+
+struct BatchLayout {
+  BatchLayoutType type{LAYOUT_AOS};
+  // number of vectors per block of the interleaved layout
+  std::size_t lanes{8};
+
+  BatchLayout() = default;
+  BatchLayout(BatchLayoutType type, std::size_t lanes = 8)
+      : type(type), lanes(lanes) {
+    if (type == LAYOUT_INTERLEAVED && lanes == 0) {
+      throw std::runtime_error("The interleaved layout requires lanes > 0.");
+    }
+  }
+
+  /**
+   * Position of the first entry of vector `s` in a batch of `n` vectors of
+   * dimension `dim`.
+   */
+  std::size_t offset(std::size_t s, std::size_t n, std::size_t dim) const {
+    switch (type) {
+      case LAYOUT_SOA:
+        return s;
+      case LAYOUT_INTERLEAVED:
+        return (s / lanes) * lanes * dim + s % lanes;
+      default:
+        return s * dim;
+    }
+  }
+
+  /**
+   * Distance between consecutive entries of a vector in a batch of `n`
+   * vectors.
+   */
+  std::size_t stride(std::size_t n) const {
+    switch (type) {
+      case LAYOUT_SOA:
+        return n;
+      case LAYOUT_INTERLEAVED:
+        return lanes;
+      default:
+        return 1;
+    }
+  }
+
+  /**
+   * Size of the buffer of a batch of `n` vectors of dimension `dim`. The last
+   * block of the interleaved layout is padded to `lanes` vectors.
+   */
+  std::size_t size(std::size_t n, std::size_t dim) const {
+    if (type == LAYOUT_INTERLEAVED) {
+      return (n + lanes - 1) / lanes * lanes * dim;
+    }
+    return n * dim;
+  }
+};
+
+/**
+ * Positions of the entries of a row-major Jacobian with `rows` x `cols`
+ * entries in a Jacobian of the given order, or an empty vector if the order
+ * is row-major.
+ */
+inline std::vector<std::size_t> jacobian_positions(std::size_t rows,
+                                                   std::size_t cols,
+                                                   MatrixOrder order) {
+  std::vector<std::size_t> positions;
+  if (order == COLUMN_MAJOR) {
+    positions.resize(rows * cols);
+    for (std::size_t r = 0; r < rows; ++r) {
+      for (std::size_t c = 0; c < cols; ++c) {
+        positions[r * cols + c] = c * rows + r;
+      }
+    }
+  }
+  return positions;
+}
+
+/**
+ * Copies the `n` vectors of dimension `dim` from `buffer` in the given
+ * layout.
+ */
+template <typename Scalar>
+void gather_batch(std::size_t n, std::size_t dim, const Scalar *buffer,
+                  const BatchLayout &layout,
+                  std::vector<std::vector<Scalar>> &vectors) {
+  const std::size_t stride = layout.stride(n);
+  vectors.resize(n);
+  for (std::size_t s = 0; s < n; ++s) {
+    const Scalar *v = buffer + layout.offset(s, n, dim);
+    vectors[s].resize(dim);
+    for (std::size_t i = 0; i < dim; ++i) {
+      vectors[s][i] = v[i * stride];
+    }
+  }
+}
+
+/**
+ * Stores the entries of `vector`, vector `s` of a batch of `n` vectors, in
+ * `buffer` in the given layout, where entry `i` is stored as entry
+ * `positions[i]` of the vector (or `i` if `positions` is empty).
+ */
+template <typename Scalar>
+void scatter_sample(std::size_t s, std::size_t n, std::size_t dim,
+                    const Scalar *vector, Scalar *buffer,
+                    const BatchLayout &layout,
+                    const std::vector<std::size_t> &positions = {}) {
+  const std::size_t stride = layout.stride(n);
+  Scalar *v = buffer + layout.offset(s, n, dim);
+  if (positions.empty()) {
+    for (std::size_t i = 0; i < dim; ++i) {
+      v[i * stride] = vector[i];
+    }
+  } else {
+    for (std::size_t i = 0; i < dim; ++i) {
+      v[positions[i] * stride] = vector[i];
+    }
+  }
+}
+
+/**
+ * Stores `vectors` in `buffer` in the given layout (see `scatter_sample`).
+ */
+template <typename Scalar>
+void scatter_batch(const std::vector<std::vector<Scalar>> &vectors,
+                   Scalar *buffer, const BatchLayout &layout,
+                   const std::vector<std::size_t> &positions = {}) {
+  for (std::size_t s = 0; s < vectors.size(); ++s) {
+    scatter_sample(s, vectors.size(), vectors[s].size(), vectors[s].data(),
+                   buffer, layout, positions);
+  }
+}
+
+#ifdef USE_EIGEN
+// maps of const buffers are read-only
+template <typename Scalar, int Cols>
+using MappedMatrix = std::conditional_t<
+    std::is_const_v<Scalar>,
+    const Eigen::Matrix<std::remove_const_t<Scalar>, Eigen::Dynamic, Cols>,
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Cols>>;
+template <typename Scalar>
+using StridedMatrixMap =
+    Eigen::Map<MappedMatrix<Scalar, Eigen::Dynamic>, Eigen::Unaligned,
+               Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>>;
+template <typename Scalar>
+using StridedVectorMap = Eigen::Map<MappedMatrix<Scalar, 1>, Eigen::Unaligned,
+                                    Eigen::InnerStride<Eigen::Dynamic>>;
+
+/**
+ * Eigen view of vector `s` in a batch of `n` vectors of dimension `dim`.
+ */
+template <typename Scalar>
+StridedVectorMap<Scalar> sample_map(Scalar *buffer, std::size_t s,
+                                    std::size_t n, std::size_t dim,
+                                    const BatchLayout &layout) {
+  return StridedVectorMap<Scalar>(
+      buffer + layout.offset(s, n, dim), dim,
+      Eigen::InnerStride<Eigen::Dynamic>(layout.stride(n)));
+}
+
+/**
+ * Eigen view of the `rows` x `cols` Jacobian of sample `s` in a batch of `n`
+ * Jacobians stored in the given layout and order.
+ */
+template <typename Scalar>
+StridedMatrixMap<Scalar> jacobian_map(Scalar *buffer, std::size_t s,
+                                      std::size_t n, std::size_t rows,
+                                      std::size_t cols,
+                                      const BatchLayout &layout,
+                                      MatrixOrder order) {
+  const std::size_t stride = layout.stride(n);
+  // Eigen's strides are given as (outer = between columns, inner = between
+  // rows) for column-major maps
+  using Strides = Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>;
+  const Strides strides = order == ROW_MAJOR
+                              ? Strides(stride, cols * stride)
+                              : Strides(rows * stride, stride);
+  return StridedMatrixMap<Scalar>(buffer + layout.offset(s, n, rows * cols),
+                                  rows, cols, strides);
+}
+
+/**
+ * Eigen view of a batch of `n` vectors of dimension `dim` as a `dim` x `n`
+ * matrix with one sample per column. The interleaved layout cannot be
+ * represented by a single strided map.
+ */
+template <typename Scalar>
+StridedMatrixMap<Scalar> batch_map(Scalar *buffer, std::size_t n,
+                                   std::size_t dim, const BatchLayout &layout) {
+  if (layout.type == LAYOUT_INTERLEAVED) {
+    throw std::runtime_error(
+        "The interleaved layout cannot be mapped to a single Eigen matrix, "
+        "use sample_map() instead.");
+  }
+  return StridedMatrixMap<Scalar>(
+      buffer, dim, n,
+      Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(layout.offset(1, n, dim),
+                                                    layout.stride(n)));
+}
+#endif
+}  // namespace autogen
@@ -2,12 +2,18 @@
 
 #include <cppad/cg.hpp>
 #include <cppad/cg/arithmetic.hpp>
+#include <algorithm>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #ifdef USE_EIGEN
 #include <cppad/cg/support/cppadcg_eigen.hpp>
 #endif
 
 #include "base.hpp"
+#include "parallel_codegen.hpp"
 #include "types.h"
 
 // #define DEBUG 1
@@ -29,12 +35,18 @@ struct FunctionTrace {
   std::string name;
 
   std::shared_ptr<ADFun> tape{nullptr};
-  // TODO fix memory leak here (bridge cannot be destructed without triggering
-  // atomic_index exception in debug mode)
+  // traces are copied, so the bridge is not owned by the trace; it is freed
+  // by `CodeGenData::release()` or `GeneratedCodeGen::release_traces()`,
+  // which CppAD only permits outside of parallel mode
   CGAtomicFunBridge *bridge{nullptr};
 
   std::vector<BaseScalar> trace_input;
 
+  // source location where the atomic function was first called, used to
+  // relate the generated code to the traced source (see `annotate_sources`)
+  std::string source_file;
+  int source_line{0};
+
   ADFunctor<BaseScalar> functor;
   int input_dim;
   int output_dim;
@@ -52,6 +64,15 @@ struct FunctionTrace {
   }
 };
 
+/**
+ * Describes an atomic function that applies another (element) atomic function
+ * to a number of independent inputs.
+ */
+struct MappedAtomic {
+  std::string element_name;
+  std::size_t num_elements{0};
+};
+
 template <typename BaseScalar = double>
 struct CodeGenData {
   /**
@@ -77,25 +98,164 @@ struct CodeGenData {
    */
   static inline bool is_dry_run{true};
 
+  /**
+   * Whether `call_atomic_map()` records a single mapped atomic function
+   * instead of one call per element. Only the CUDA backend evaluates mapped
+   * atomics in a loop, the CPU libraries would call the element functions
+   * from an extra function with the calls unrolled.
+   */
+  static inline bool map_atomics{true};
+
   /**
    * Maps name of the caller to the names of the (atomic) functions it executes.
    */
   static inline std::map<std::string, std::vector<std::string>> call_hierarchy;
 
+  /**
+   * Maps names of mapped atomic functions (see `call_atomic_map()`) to the
+   * element function they apply.
+   */
+  static inline std::map<std::string, MappedAtomic> mapped_atomics;
+
+  /**
+   * Guards the registries that are written while atomic functions are traced
+   * concurrently (see `trace_existing_atomics()`).
+   */
+  static inline std::mutex mutex;
+
+  /**
+   * Held while a function is traced and while a library is generated from
+   * the traces, which may happen in a background thread (see
+   * `GeneratedCodeGen::upgrade_to_exact_jacobian`).
+   */
+  static inline std::recursive_mutex codegen_mutex;
+
   static void clear() {
     traces->clear();
     invocation_order->clear();
     call_hierarchy.clear();
     invocation_stack->clear();
+    mapped_atomics.clear();
+  }
+
+  /**
+   * Records that function `parent` calls the atomic function `name`.
+   */
+  static void add_call(const std::string &parent, const std::string &name) {
+    auto &callees = call_hierarchy[parent];
+    if (std::find(callees.begin(), callees.end(), name) == callees.end()) {
+      callees.push_back(name);
+    }
+  }
+
+  /**
+   * Returns the atomic functions ordered such that every function comes after
+   * all atomic functions it calls. Independent functions keep their order of
+   * invocation, which makes the order identical across runs.
+   */
+  static std::vector<std::string> dependency_order() {
+    std::vector<std::string> result;
+    std::set<std::string> visited;
+    std::function<void(const std::string &)> visit =
+        [&](const std::string &name) {
+          if (!visited.insert(name).second) {
+            return;
+          }
+          const auto it = call_hierarchy.find(name);
+          if (it != call_hierarchy.end()) {
+            for (const auto &callee : it->second) {
+              visit(callee);
+            }
+          }
+          result.push_back(name);
+        };
+    for (const auto &name : *invocation_order) {
+      visit(name);
+    }
+    return result;
+  }
+
+  /**
+   * Returns the names of the tapes that are evaluated when generating code
+   * for function `name`, i.e. its own tape and the tapes of all atomic
+   * functions it calls directly or indirectly. A main function whose calls
+   * have not been recorded (e.g. one traced from Python) is assumed to call
+   * all atomic functions.
+   */
+  static std::set<std::string> used_tapes(const std::string &name) {
+    std::set<std::string> result{name};
+    if (traces->find(name) == traces->end() &&
+        call_hierarchy.find(name) == call_hierarchy.end()) {
+      result.insert(invocation_order->begin(), invocation_order->end());
+      return result;
+    }
+    std::vector<std::string> stack{name};
+    while (!stack.empty()) {
+      const auto it = call_hierarchy.find(stack.back());
+      stack.pop_back();
+      if (it == call_hierarchy.end()) {
+        continue;
+      }
+      for (const auto &callee : it->second) {
+        if (result.insert(callee).second) {
+          stack.push_back(callee);
+        }
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Removes the traces of the atomic functions that the main function `name`
+   * calls directly or indirectly and frees their bridges, which are
+   * otherwise kept alive for the lifetime of the process. The traces of
+   * other functions are kept. Nothing is released if the calls of `name`
+   * are no longer recorded, i.e. another function has been traced since.
+   */
+  static void release(const std::string &name) {
+    std::lock_guard<std::recursive_mutex> lock(codegen_mutex);
+    if (call_hierarchy.find(name) == call_hierarchy.end()) {
+      return;
+    }
+    const std::set<std::string> names = used_tapes(name);
+    for (const auto &atomic : names) {
+      const auto it = traces->find(atomic);
+      if (it == traces->end()) {
+        continue;
+      }
+      // the bridge refers to the tape
+      delete it->second.bridge;
+      it->second.bridge = nullptr;
+      it->second.tape.reset();
+      traces->erase(it);
+      call_hierarchy.erase(atomic);
+      mapped_atomics.erase(atomic);
+    }
+    call_hierarchy.erase(name);
+    invocation_order->erase(
+        std::remove_if(invocation_order->begin(), invocation_order->end(),
+                       [&](const std::string &atomic) {
+                         return names.count(atomic) > 0;
+                       }),
+        invocation_order->end());
   }
 
   CodeGenData() = delete;
 };
 
+/**
+ * Calls the atomic function `name`, which is traced once and becomes a
+ * separate function in the generated code. Besides reusing code, this allows
+ * to mark regions of the user functor that should show up as individual
+ * functions in profilers. The source location of the (first) call is recorded
+ * for the symbol map of the generated library.
+ */
 template <typename BaseScalar = double>
 inline void call_atomic(const std::string &name, ADFunctor<BaseScalar> functor,
                         const std::vector<ADCG<BaseScalar>> &input,
-                        std::vector<ADCG<BaseScalar>> &output) {
+                        std::vector<ADCG<BaseScalar>> &output,
+                        const char *source_file = __builtin_FILE(),
+                        int source_line = __builtin_LINE()) {
   using ADFun = typename FunctionTrace<BaseScalar>::ADFun;
   using CGAtomicFunBridge =
       typename FunctionTrace<BaseScalar>::CGAtomicFunBridge;
@@ -113,18 +273,15 @@ inline void call_atomic(const std::string &name, ADFunctor<BaseScalar> functor,
     if (!stack.empty()) {
       // the current function is called by another function, hence update the
       // call hierarchy
-      const std::string &parent = stack.back();
-      auto &hierarchy = CodeGenData<BaseScalar>::call_hierarchy;
-      if (hierarchy.find(parent) == hierarchy.end()) {
-        hierarchy[parent] = std::vector<std::string>();
-      }
-      hierarchy[parent].push_back(name);
+      CodeGenData<BaseScalar>::add_call(stack.back(), name);
     }
     order.push_back(name);
     stack.push_back(name);
     FunctionTrace<BaseScalar> trace;
     trace.name = name;
     trace.functor = functor;
+    trace.source_file = source_file;
+    trace.source_line = source_line;
     trace.trace_input.resize(input.size());
     trace.input_dim = static_cast<int>(input.size());
     trace.output_dim = static_cast<int>(output.size());
@@ -160,6 +317,12 @@ inline void call_atomic(const std::string &name, ADFunctor<BaseScalar> functor,
 #if DEBUG
     std::cout << "\tAlready traced during this dry run.\n";
 #endif
+    const auto &stack = *CodeGenData<BaseScalar>::invocation_stack;
+    if (!stack.empty()) {
+      // the function may be called from another function than the one it
+      // was discovered in
+      CodeGenData<BaseScalar>::add_call(stack.back(), name);
+    }
     // std::cout << "Invocation order: ";
     // for (const auto &s : *CodeGenData<BaseScalar>::invocation_order) {
     //   std::cout << s << " ";
@@ -173,7 +336,8 @@ inline void call_atomic(const std::string &name, ADFunctor<BaseScalar> functor,
   std::cout << "\tCalling existing function trace.\n";
 #endif
 
-  FunctionTrace<BaseScalar> &trace = (*traces)[name];
+  // no insertion, the atomics may be traced concurrently
+  FunctionTrace<BaseScalar> &trace = traces->at(name);
   if (!trace.bridge) {
     throw std::runtime_error("CGAtomicFunBridge for atomic function \"" + name +
                              "\" is missing. Make sure to call `trace_existing_atomics()`.");
@@ -187,59 +351,124 @@ inline void call_atomic(const std::string &name, ADFunctor<BaseScalar> functor,
   // std::cout << std::endl;
 }
 
-void trace_existing_atomics() {
+/**
+ * Traces the atomic functions that have been discovered during the dry run,
+ * after the atomic functions they call. Atomic functions at the same depth of
+ * the call hierarchy are independent of each other and can be recorded
+ * concurrently on up to `num_threads` threads (0 uses all hardware threads),
+ * which requires their functors to be thread-safe. By default, they are
+ * recorded sequentially.
+ */
+void trace_existing_atomics(std::size_t num_threads = 1) {
   using CGScalar = typename CppAD::cg::CG<BaseScalar>;
   using ADCGScalar = typename CppAD::AD<CGScalar>;
   using ADFun = typename CppAD::ADFun<CGScalar>;
   using CGAtomicFunBridge = typename CppAD::cg::CGAtomicFunBridge<BaseScalar>;
 
-  const auto &order = *CodeGenData<BaseScalar>::invocation_order;
-  // for (auto it = order.rbegin(); it != order.rend(); ++it) {
-  for (auto& [name, trace] : *CodeGenData<BaseScalar>::traces) {
-    // FunctionTrace<BaseScalar> &trace = (*CodeGenData<BaseScalar>::traces)[*it];
-    if (trace.bridge) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // group the atomics by their depth in the call hierarchy, nested atomics
+  // need to be traced before the functions that call them; within a level,
+  // the atomics are registered in the same order in every run
+  auto &traces = *CodeGenData<BaseScalar>::traces;
+  const auto &hierarchy = CodeGenData<BaseScalar>::call_hierarchy;
+  std::map<std::string, std::size_t> depth;
+  std::vector<std::vector<FunctionTrace<BaseScalar> *>> levels;
+  for (const std::string &name : CodeGenData<BaseScalar>::dependency_order()) {
+    std::size_t level = 0;
+    const auto callees = hierarchy.find(name);
+    if (callees != hierarchy.end()) {
+      for (const auto &callee : callees->second) {
+        level = std::max(level, depth[callee] + 1);
+      }
+    }
+    depth[name] = level;
+    auto trace_it = traces.find(name);
+    if (trace_it == traces.end()) {
+      // atomic functions defined in Python register their traces separately
+      continue;
+    }
+    if (trace_it->second.bridge) {
       continue;
     }
-    std::cout << "Tracing atomic function \"" << trace.name
-              << "\" for code generation...\n";
-    trace.ax.resize(trace.input_dim);
-    trace.ay.resize(trace.output_dim);
-    for (size_t i = 0; i < trace.input_dim; ++i) {
-      trace.ax[i] = ADCGScalar(to_double(trace.trace_input[i]));
+    if (levels.size() <= level) {
+      levels.resize(level + 1);
+    }
+    levels[level].push_back(&trace_it->second);
+  }
+
+  for (const auto &level : levels) {
+    for (const auto *trace : level) {
+      std::cout << "Tracing atomic function \"" << trace->name
+                << "\" for code generation...\n";
+    }
+    // a recording evaluates the bridges of the atomics it calls, which write
+    // the Taylor coefficients of their tapes
+    std::vector<std::set<std::string>> tapes;
+    for (const auto *trace : level) {
+      tapes.push_back(CodeGenData<BaseScalar>::used_tapes(trace->name));
+    }
+    run_codegen_jobs<BaseScalar>(tapes, num_threads, [&](std::size_t i) {
+      // each thread records on its own CppAD tape
+      FunctionTrace<BaseScalar> &trace = *level[i];
+      trace.ax.resize(trace.input_dim);
+      trace.ay.resize(trace.output_dim);
+      for (size_t j = 0; j < trace.input_dim; ++j) {
+        trace.ax[j] = ADCGScalar(to_double(trace.trace_input[j]));
+      }
+      CppAD::Independent(trace.ax);
+      trace.functor(trace.ax, trace.ay);
+      trace.tape = std::make_shared<ADFun>();
+      trace.tape->Dependent(trace.ax, trace.ay);
+      trace.tape->function_name_set(trace.name);
+    });
+    // CppAD's atomic functions can only be constructed in sequential mode
+    for (auto *trace : level) {
+      trace->bridge = new CGAtomicFunBridge(trace->name, *(trace->tape), true);
     }
-    CppAD::Independent(trace.ax);
-    trace.functor(trace.ax, trace.ay);
-    trace.tape = std::make_shared<ADFun>();
-    trace.tape->Dependent(trace.ax, trace.ay);
-    trace.tape->function_name_set(trace.name);
-    trace.bridge = new CGAtomicFunBridge(trace.name, *(trace.tape), true);
   }
 }
 
+/**
+ * Traces `functor` and the atomic functions it calls. If `map_atomics` is
+ * false, the calls of `call_atomic_map()` are recorded as separate calls of
+ * the element function (see `CodeGenData::map_atomics`).
+ */
 template <typename Functor>
 static FunctionTrace<BaseScalar> trace(Functor functor, const std::string &name,
                                        const std::vector<BaseScalar> &input,
-                                       std::vector<BaseScalar> &output) {
+                                       std::vector<BaseScalar> &output,
+                                       std::size_t num_threads = 1,
+                                       bool map_atomics = true) {
   using CGScalar = typename CppAD::cg::CG<BaseScalar>;
   using ADCGScalar = typename CppAD::AD<CGScalar>;
   using ADFun = typename CppAD::ADFun<CGScalar>;
   using CGAtomicFunBridge = typename CppAD::cg::CGAtomicFunBridge<BaseScalar>;
 
+  std::lock_guard<std::recursive_mutex> lock(
+      CodeGenData<BaseScalar>::codegen_mutex);
   CodeGenData<BaseScalar>::clear();
+  CodeGenData<BaseScalar>::map_atomics = map_atomics;
 
-  // first, a "dry run" to discover the atomic functions
+  // first, a "dry run" to discover the atomic functions; the main function
+  // is on the invocation stack so that the atomic functions it calls
+  // directly are recorded in the call hierarchy
   {
     CodeGenData<BaseScalar>::is_dry_run = true;
     std::vector<ADCGScalar> ax(input.size()), ay(output.size());
     for (size_t i = 0; i < input.size(); ++i) {
       ax[i] = ADCGScalar(to_double(input[i]));
     }
+    CodeGenData<BaseScalar>::invocation_stack->push_back(name);
     functor(ax, ay);
+    CodeGenData<BaseScalar>::invocation_stack->pop_back();
     CodeGenData<BaseScalar>::is_dry_run = false;
   }
 
   // next, trace the inner atomic functions
-  trace_existing_atomics();
+  trace_existing_atomics(num_threads);
 
   // finally, trace the top-level function
   FunctionTrace<BaseScalar> trace;
@@ -270,6 +499,96 @@ inline void call_atomic(
   functor(input, output);
 }
 
+/**
+ * Applies the atomic function `name` to each of the K `inputs`. Instead of K
+ * separate call sites, a single call to the mapped atomic function
+ * "<name>_map<K>" is recorded, which in turn applies the element function to
+ * each input. `outputs` has to contain K vectors of the output dimension.
+ * If atomics are not mapped (see `CodeGenData::map_atomics`), the element
+ * function is called K times directly.
+ */
+template <typename BaseScalar = double>
+inline void call_atomic_map(
+    const std::string &name, ADFunctor<BaseScalar> functor,
+    const std::vector<std::vector<ADCG<BaseScalar>>> &inputs,
+    std::vector<std::vector<ADCG<BaseScalar>>> &outputs,
+    const char *source_file = __builtin_FILE(),
+    int source_line = __builtin_LINE()) {
+  if (inputs.empty()) {
+    return;
+  }
+  if (outputs.size() != inputs.size()) {
+    throw std::runtime_error("Mapped atomic function \"" + name +
+                             "\" requires as many output vectors (" +
+                             std::to_string(outputs.size()) + ") as inputs (" +
+                             std::to_string(inputs.size()) + ").");
+  }
+  if (!CodeGenData<BaseScalar>::map_atomics) {
+    for (std::size_t k = 0; k < inputs.size(); ++k) {
+      call_atomic<BaseScalar>(name, functor, inputs[k], outputs[k],
+                              source_file, source_line);
+    }
+    return;
+  }
+  const std::size_t num_elements = inputs.size();
+  const std::size_t input_dim = inputs[0].size();
+  const std::size_t output_dim = outputs[0].size();
+  const std::string map_name = name + "_map" + std::to_string(num_elements);
+  {
+    // the calling function may be traced concurrently with other atomics
+    std::lock_guard<std::mutex> lock(CodeGenData<BaseScalar>::mutex);
+    CodeGenData<BaseScalar>::mapped_atomics[map_name] =
+        MappedAtomic{name, num_elements};
+  }
+
+  ADFunctor<BaseScalar> map_functor =
+      [name, functor, num_elements, input_dim, output_dim, source_file,
+       source_line](const std::vector<ADCG<BaseScalar>> &in,
+                    std::vector<ADCG<BaseScalar>> &out) {
+        std::vector<ADCG<BaseScalar>> x(input_dim), y(output_dim);
+        for (std::size_t k = 0; k < num_elements; ++k) {
+          std::copy(in.begin() + k * input_dim,
+                    in.begin() + (k + 1) * input_dim, x.begin());
+          call_atomic<BaseScalar>(name, functor, x, y, source_file,
+                                  source_line);
+          std::copy(y.begin(), y.end(), out.begin() + k * output_dim);
+        }
+      };
+
+  std::vector<ADCG<BaseScalar>> flat_input(num_elements * input_dim);
+  std::vector<ADCG<BaseScalar>> flat_output(num_elements * output_dim);
+  for (std::size_t k = 0; k < num_elements; ++k) {
+    if (inputs[k].size() != input_dim || outputs[k].size() != output_dim) {
+      throw std::runtime_error("All inputs and outputs of mapped atomic \"" +
+                               name + "\" must have the same dimensions.");
+    }
+    std::copy(inputs[k].begin(), inputs[k].end(),
+              flat_input.begin() + k * input_dim);
+    std::copy(outputs[k].begin(), outputs[k].end(),
+              flat_output.begin() + k * output_dim);
+  }
+  call_atomic<BaseScalar>(map_name, map_functor, flat_input, flat_output,
+                          source_file, source_line);
+  for (std::size_t k = 0; k < num_elements; ++k) {
+    std::copy(flat_output.begin() + k * output_dim,
+              flat_output.begin() + (k + 1) * output_dim, outputs[k].begin());
+  }
+}
+
+template <typename Scalar>
+inline void call_atomic_map(
+    const std::string &name,
+    const std::function<void(const std::vector<Scalar> &,
+                             std::vector<Scalar> &)> &functor,
+    const std::vector<std::vector<Scalar>> &inputs,
+    std::vector<std::vector<Scalar>> &outputs) {
+  // no tracing occurs since the arguments are not of code generation type
+  outputs.resize(inputs.size());
+  for (std::size_t k = 0; k < inputs.size(); ++k) {
+    functor(inputs[k], outputs[k]);
+  }
+}
+
 /**
  * More overloads for the atomic function to be traced:
  */
@@ -279,12 +598,15 @@ inline ADCG<BaseScalar> call_atomic(
     const std::string &name,
     const std::function<ADCG<BaseScalar>(const std::vector<ADCG<BaseScalar>> &)>
         &functor,
-    const std::vector<ADCG<BaseScalar>> &input) {
+    const std::vector<ADCG<BaseScalar>> &input,
+    const char *source_file = __builtin_FILE(),
+    int source_line = __builtin_LINE()) {
   ADFunctor<BaseScalar> vec_fun =
       [functor](const std::vector<ADCG<BaseScalar>> &in,
                 std::vector<ADCG<BaseScalar>> &out) { out[0] = functor(in); };
   std::vector<ADCG<BaseScalar>> output(1);
-  call_atomic<BaseScalar>(name, vec_fun, input, output);
+  call_atomic<BaseScalar>(name, vec_fun, input, output, source_file,
+                          source_line);
   return output[0];
 }
 
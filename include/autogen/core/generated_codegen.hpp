@@ -1,21 +1,37 @@
 #pragma once
 
 // clang-format off
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <array>
+#include <chrono>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <set>
 #include <thread>
 
 #include "../utils/conditionals.hpp"
+#include "../utils/perf_counters.hpp"
 
 #include "../cuda/cuda_codegen.hpp"
 #include "../cuda/cuda_library_processor.hpp"
 #include "../cuda/cuda_library.hpp"
 
+#include "autotuning.hpp"
 #include "codegen.hpp"
+#include "header_export.hpp"
+#include "isa_dispatch.hpp"
+#include "parallel_codegen.hpp"
+#include "static_library.hpp"
 // clang-format on
 
 namespace autogen {
@@ -60,17 +76,81 @@ class GeneratedCodeGen : public GeneratedBase {
 
   mutable std::shared_ptr<CudaLibrary<BaseScalar>> cuda_library_{nullptr};
 
+  /**
+   * CUDA kernels are specialized to the number of global inputs, hence one
+   * compiled library is kept per global input dimension.
+   */
+  struct CudaLibraryEntry {
+    std::string library_name;
+    std::shared_ptr<CudaLibrary<BaseScalar>> library;
+  };
+  std::map<int, CudaLibraryEntry> cuda_libraries_;
+
 #if AUTOGEN_SYSTEM_WIN
   typedef CppAD::cg::WindowsDynamicLib<BaseScalar> DynamicLib;
 #else
   typedef CppAD::cg::LinuxDynamicLib<BaseScalar> DynamicLib;
 #endif
-  mutable std::shared_ptr<DynamicLib> cpu_library_{nullptr};
+  // shared library or a static library linked into the executable
+  mutable std::shared_ptr<CppAD::cg::FunctorModelLibrary<BaseScalar>>
+      cpu_library_{nullptr};
   mutable std::map<std::string, GenericModelPtr> cpu_models_;
+  // main model of the loaded CPU library
+  mutable GenericModel *cpu_model_{nullptr};
+
+  // separate library that provides the Jacobian (see `lazy_jacobian`), empty
+  // if the Jacobian is part of the main library
+  std::string jacobian_library_name_;
+  mutable std::shared_ptr<CppAD::cg::FunctorModelLibrary<BaseScalar>>
+      jacobian_cpu_library_{nullptr};
+  mutable std::map<std::string, GenericModelPtr> jacobian_cpu_models_;
+  mutable GenericModel *jacobian_cpu_model_{nullptr};
+
+  PerfCounterReport perf_report_;
+
+  // tuning file that has been looked up (see `load_tuning()`)
+  std::string tuning_file_;
+  bool autotuning_{false};
+  // whether a batched forward pass has tuned the library since the flag was
+  // last cleared (see `autotune_on_first_use`)
+  bool tuned_on_first_use_{false};
+  // makes the first-use tuning of a library happen once if its first batched
+  // evaluations run concurrently
+  std::recursive_mutex tuning_mutex_;
 
  public:
   int num_gpu_threads_per_block{32};
 
+  /**
+   * Parallelization settings of the batched forward and Jacobian passes: the
+   * number of CPU threads and the size of the chunks of samples they are
+   * assigned, and the number of CUDA threads per block. They are set by
+   * `autotune()`, and loaded from the tuning file
+   * "<name>_<Jacobian mode>_tuning.txt" next to the library at its first
+   * batched evaluation (see `tuning_filename()`).
+   */
+  TuningResult tuning;
+
+  /**
+   * Whether the first batched forward or Jacobian pass of a library whose
+   * tuning file has no settings for that pass runs `autotune()` on its
+   * inputs, tuning only the pass that is evaluated.
+   */
+  bool autotune_on_first_use{false};
+
+  /**
+   * Number of timed evaluations of each configuration benchmarked by
+   * `autotune()`, of which the fastest one counts.
+   */
+  int autotune_repetitions{3};
+
+  /**
+   * Minimum wall time in seconds of a timed evaluation in `autotune()`.
+   * Shorter evaluations are repeated until it is reached and their average
+   * duration is used.
+   */
+  double autotune_min_time{0.01};
+
   /**
    * Whether the generated code is compiled in debug mode (only applies to CPU
    * and CUDA).
@@ -93,9 +173,137 @@ class GeneratedCodeGen : public GeneratedBase {
    */
   bool generate_jacobian{true};
 
+  /**
+   * Number of threads that generate the sources of the atomic functions and
+   * the main function concurrently (0 uses all hardware threads, 1 generates
+   * them sequentially).
+   */
+  int num_codegen_threads{0};
+
+  /**
+   * Whether to only compile the zero-order forward pass for the CPU and to
+   * approximate the Jacobian by finite differences of the compiled function.
+   * This avoids generating and compiling the Jacobian code, which usually
+   * takes considerably longer than the forward pass.
+   */
+  bool finite_difference_jacobian{false};
+
+  /**
+   * Whether to use central (instead of forward) differences for the finite
+   * difference Jacobian.
+   */
+  bool central_differences{true};
+
+  /**
+   * Step size to use for finite differencing.
+   */
+  double finite_diff_eps{1e-6};
+
+  /**
+   * Whether to compile the exact Jacobian in a background thread when
+   * `finite_difference_jacobian` is active. Once finished, the compiled
+   * library with the exact Jacobian replaces the finite-difference mode.
+   */
+  bool upgrade_to_exact_jacobian{false};
+
+  /**
+   * Whether to compile the Jacobian into a separate CPU library
+   * ("<name>_cpu_jacobian") that is only built when the Jacobian is evaluated
+   * for the first time. The forward pass is available as soon as its library
+   * has been compiled, which is usually much faster than compiling the
+   * Jacobian.
+   */
+  bool lazy_jacobian{false};
+
+  /**
+   * Whether the separate Jacobian library (see `lazy_jacobian`) is compiled
+   * in a background thread right after the forward library. Jacobian
+   * evaluations wait for it to finish, or approximate the Jacobian by finite
+   * differences in the meantime if `finite_difference_jacobian` is active.
+   */
+  bool background_jacobian{false};
+
+  /**
+   * Whether to release the traces (see `release_traces()`) once the library
+   * with the exact Jacobian has been adopted. Used instead of releasing them
+   * right after compilation while the exact Jacobian still needs to be
+   * compiled from the traces (see `jacobian_needs_traces()`).
+   */
+  bool release_traces_after_jacobian{false};
+
+  /**
+   * Groups of output indices that are computed by the same expression
+   * pattern. If not empty, CppADCodeGen's pattern-based loop detection turns
+   * the repeated computations into loops instead of unrolling them.
+   */
+  std::vector<std::set<std::size_t>> related_dependents;
+
+  /**
+   * Marks the outputs as related that are `block_size` indices apart, i.e.
+   * the output consists of repeated blocks of `block_size` entries that are
+   * computed by the same expressions.
+   */
+  void set_repeated_output_blocks(std::size_t block_size) {
+    related_dependents.clear();
+    if (block_size == 0 || output_dim_ <= 0) {
+      return;
+    }
+    for (std::size_t i = 0; i < block_size; ++i) {
+      std::set<std::size_t> related;
+      for (std::size_t j = i; j < static_cast<std::size_t>(output_dim_);
+           j += block_size) {
+        related.insert(j);
+      }
+      if (related.size() > 1) {
+        related_dependents.push_back(related);
+      }
+    }
+  }
+
+  /**
+   * Whether to sample hardware performance counters (cycles, instructions,
+   * cache misses and vector instructions) and timings in the evaluation
+   * functions. The readings are collected per entry point and summed over all
+   * worker threads, see `performance_report()`.
+   */
+  bool profile_performance{false};
+
+  /**
+   * Whether to compile the generated code with line information (keeping the
+   * optimization level), keep the functions of atomic functions as separate
+   * symbols, and write the symbol map "<library>_symbols.txt" next to the
+   * library. The map relates every generated function to the traced function
+   * it was generated from, including the source location of its
+   * `call_atomic()` call, so that profiles of the compiled library can be
+   * attributed to the structure of the traced code.
+   */
+  bool annotate_sources{false};
+
+  /**
+   * Instruction set variants of the CPU libraries (e.g.
+   * `default_isa_variants()`). Every shared CPU library is additionally
+   * compiled once per variant, and the first variant in this list that the
+   * CPU supports is loaded instead of the baseline library, which remains
+   * the fallback for all other CPUs. The compiled variants are recorded in
+   * "<library>_isa.txt", so that precompiled libraries are dispatched the
+   * same way. Static archives only contain the baseline.
+   */
+  std::vector<IsaVariant> isa_variants;
+
+  const PerfCounterReport &performance_report() const { return perf_report_; }
+  void print_performance_report(std::ostream &os = std::cout) const {
+    perf_report_.print(name_, os);
+  }
+  void reset_performance_report() { perf_report_.clear(); }
+
   CodeGenTarget target() const { return target_; }
   void set_target(CodeGenTarget target) { target_ = target; }
 
+  /**
+   * Compiler of the CPU libraries. It is used by the background compilation
+   * of the exact Jacobian, replace it via the `set_cpu_compiler_*()`
+   * functions, which wait for the background compilation.
+   */
   std::shared_ptr<AbstractCCompiler> cpu_compiler{nullptr};
 
   GeneratedCodeGen(const FunctionTrace<BaseScalar> &main_trace)
@@ -113,6 +321,17 @@ class GeneratedCodeGen : public GeneratedBase {
     std::cout << "tape->Domain(): " << tape->Domain() << std::endl;
   }
 
+  /**
+   * Function that has not been traced and can only be evaluated through a
+   * precompiled library (see `load_precompiled_library()`).
+   */
+  explicit GeneratedCodeGen(const std::string &name) : name_(name) {}
+
+  ~GeneratedCodeGen() { wait_for_jacobian_upgrade(); }
+
+  using GeneratedBase::operator();
+  using GeneratedBase::jacobian;
+
   void set_cpu_compiler_clang(
       std::string compiler_path = "",
       const std::vector<std::string> &compile_flags =
@@ -121,6 +340,8 @@ class GeneratedCodeGen : public GeneratedBase {
     if (compiler_path.empty()) {
       compiler_path = autogen::find_exe("clang");
     }
+    std::lock_guard<std::recursive_mutex> lock(
+        CodeGenData<BaseScalar>::codegen_mutex);
     cpu_compiler = std::make_shared<ClangCompiler>(compiler_path);
     for (const auto &flag : compile_flags) {
       cpu_compiler->addCompileFlag(flag);
@@ -138,6 +359,8 @@ class GeneratedCodeGen : public GeneratedBase {
     if (compiler_path.empty()) {
       compiler_path = autogen::find_exe("gcc");
     }
+    std::lock_guard<std::recursive_mutex> lock(
+        CodeGenData<BaseScalar>::codegen_mutex);
     cpu_compiler = std::make_shared<GccCompiler>(compiler_path);
     for (const auto &flag : compile_flags) {
       cpu_compiler->addCompileFlag(flag);
@@ -158,6 +381,8 @@ class GeneratedCodeGen : public GeneratedBase {
     if (linker_path.empty()) {
       linker_path = autogen::find_exe("link.exe");
     }
+    std::lock_guard<std::recursive_mutex> lock(
+        CodeGenData<BaseScalar>::codegen_mutex);
     cpu_compiler = std::make_shared<MsvcCompiler>(compiler_path, linker_path);
     for (const auto &flag : compile_flags) {
       cpu_compiler->addCompileFlag(flag);
@@ -169,26 +394,133 @@ class GeneratedCodeGen : public GeneratedBase {
 
   // discards the compiled library (so that it gets recompiled at the next
   // evaluation)
-  void discard_library() { library_name_ = ""; }
+  void discard_library() {
+    // a background compilation of the exact Jacobian of the discarded
+    // library must not be adopted
+    ++library_generation_;
+    exact_jacobian_pending_ = false;
+    exact_jacobian_ = true;
+    separate_jacobian_ = false;
+    {
+      std::lock_guard<std::mutex> lock(cpu_library_loading_mutex_);
+      library_name_ = "";
+      jacobian_library_name_ = "";
+      cpu_model_ = nullptr;
+      cpu_models_.clear();
+      cpu_library_.reset();
+      jacobian_cpu_model_ = nullptr;
+      jacobian_cpu_models_.clear();
+      jacobian_cpu_library_.reset();
+    }
+    tuning_file_ = "";
+    cuda_library_ = nullptr;
+    cuda_libraries_.clear();
+  }
 
   const std::string &library_name() const { return library_name_; }
+
+  /**
+   * Evaluates the function through the library `library_name` compiled for
+   * the current target. If the function has not been traced, the dimensions
+   * of a CPU library are taken from its main model, which is loaded right
+   * away (for CUDA libraries they have to be set beforehand).
+   */
   void load_precompiled_library(const std::string &library_name) {
     if (library_name != library_name_) {
       discard_library();
     }
     library_name_ = library_name;
+    if (!has_traces() && target_ == TARGET_CPU) {
+      GenericModelPtr model = get_cpu_model();
+      output_dim_ = static_cast<int>(model->Range());
+      local_input_dim_ = static_cast<int>(model->Domain()) - global_input_dim_;
+    }
   }
 
+  /**
+   * Frees the tape of the traced function. Afterwards, the model can only be
+   * evaluated through its compiled library, it cannot be recompiled.
+   */
+  void release_traces() {
+    // the exact Jacobian is still being generated from the traces
+    wait_for_jacobian_upgrade();
+    // the bridge refers to the tape
+    delete main_trace_.bridge;
+    main_trace_.bridge = nullptr;
+    main_trace_.tape.reset();
+    main_trace_.ax.clear();
+    main_trace_.ay.clear();
+  }
+
+  bool has_traces() const { return main_trace_.tape != nullptr; }
+
+  /**
+   * Changes how many of the inputs are shared across a batch. The CPU library
+   * evaluates the concatenated input and supports any split without
+   * recompilation. For CUDA, the library compiled for this split is reused if
+   * it exists, otherwise the function needs to be compiled again.
+   */
   void set_global_input_dim(int dim) override {
+    if (dim == global_input_dim_) {
+      return;
+    }
+    const int total_input_dim = input_dim();
+    if (dim < 0 || dim > total_input_dim) {
+      throw std::runtime_error(
+          "The global input dimension of \"" + name_ +
+          "\" must be between 0 and " + std::to_string(total_input_dim) +
+          ", but " + std::to_string(dim) + " was provided.");
+    }
+    if (target_ == TARGET_CUDA) {
+      if (!library_name_.empty()) {
+        cuda_libraries_[global_input_dim_] = {library_name_, cuda_library_};
+      }
+      const auto it = cuda_libraries_.find(dim);
+      if (it != cuda_libraries_.end()) {
+        library_name_ = it->second.library_name;
+        cuda_library_ = it->second.library;
+      } else {
+        library_name_ = "";
+        cuda_library_ = nullptr;
+      }
+    }
     global_input_dim_ = dim;
-    local_input_dim_ = static_cast<int>(main_trace_.tape->Domain() - dim);
-    discard_library();
+    local_input_dim_ = total_input_dim - dim;
   }
 
   bool is_compiled() const { return !library_name_.empty(); }
 
+  /**
+   * Whether the exact Jacobian of the CPU library has yet to be compiled from
+   * the traces (see `lazy_jacobian` and `upgrade_to_exact_jacobian`).
+   */
+  bool jacobian_needs_traces() const {
+    return target_ == TARGET_CPU && !exact_jacobian_ &&
+           (separate_jacobian_ || jacobian_upgrade_.joinable());
+  }
+
+  /**
+   * Whether the Jacobian is currently approximated by finite differences
+   * (i.e. the exact Jacobian has not been compiled (yet)).
+   */
+  bool uses_finite_difference_jacobian() const {
+    return target_ == TARGET_CPU && !exact_jacobian_ &&
+           finite_difference_jacobian;
+  }
+
+  /**
+   * Blocks until the background compilation of the exact Jacobian (see
+   * `upgrade_to_exact_jacobian`) has finished.
+   */
+  void wait_for_jacobian_upgrade() {
+    if (jacobian_upgrade_.joinable()) {
+      jacobian_upgrade_.join();
+    }
+  }
+
   void operator()(const std::vector<BaseScalar> &input,
                   std::vector<BaseScalar> &output) override {
+    ScopedPerfCounters perf(perf_report(), "forward", 1);
     if (target_ == TARGET_CPU) {
       assert(!library_name_.empty());
       auto model = get_cpu_model();
@@ -199,9 +531,89 @@ class GeneratedCodeGen : public GeneratedBase {
     }
   }
 
+  /**
+   * Single-sample forward pass that hands the buffers directly to the
+   * compiled CPU function (CUDA models copy the buffers).
+   */
+  void operator()(const BaseScalar *input, BaseScalar *output) override {
+    if (target_ != TARGET_CPU) {
+      GeneratedBase::operator()(input, output);
+      return;
+    }
+    GenericModelPtr model = get_cpu_model();
+    ScopedPerfCounters perf(perf_report(), "forward", 1);
+    model->ForwardZero(
+        CppAD::cg::ArrayView<const BaseScalar>(input, input_dim()),
+        CppAD::cg::ArrayView<BaseScalar>(output, output_dim_));
+  }
+
+  /**
+   * Benchmarks the batched forward and Jacobian passes on `local_inputs` for
+   * the candidate thread counts and chunk sizes on the CPU (see
+   * `cpu_tuning_candidates`) or thread block sizes on the GPU (see
+   * `gpu_tuning_candidates`), applies the fastest configurations and saves
+   * them to the tuning file of the library, from where they are loaded
+   * whenever the library is evaluated again. `tune_forward` and
+   * `tune_jacobian` select the passes to tune; the settings of the other pass
+   * are kept.
+   */
+  const TuningResult &autotune(
+      const std::vector<std::vector<BaseScalar>> &local_inputs,
+      const std::vector<BaseScalar> &global_input = {},
+      bool tune_forward = true, bool tune_jacobian = true) {
+    if (library_name_.empty()) {
+      throw std::runtime_error("Function \"" + name_ +
+                               "\" needs to be compiled before it can be "
+                               "tuned.");
+    }
+    if (local_inputs.empty()) {
+      throw std::runtime_error("Function \"" + name_ +
+                               "\" cannot be tuned on an empty batch.");
+    }
+    const int num_samples = static_cast<int>(local_inputs.size());
+    const auto candidates = target_ == TARGET_CUDA
+                                ? gpu_tuning_candidates(num_samples)
+                                : cpu_tuning_candidates(num_samples);
+    std::cout << "Tuning \"" << name_ << "\" on " << num_samples
+              << " samples with " << candidates.size()
+              << " configurations...\n";
+    // the benchmark runs are not part of the performance report
+    const bool profile = profile_performance;
+    profile_performance = false;
+    autotuning_ = true;
+    std::vector<std::vector<BaseScalar>> outputs;
+    try {
+      if (generate_forward && tune_forward) {
+        tune(candidates, tuning.forward,
+             [&]() { (*this)(local_inputs, outputs, global_input); });
+        tuning.forward_tuned = true;
+      }
+      if (generate_jacobian && tune_jacobian) {
+        tune(candidates, tuning.jacobian,
+             [&]() { jacobian(local_inputs, outputs, global_input); });
+        tuning.jacobian_tuned = true;
+      }
+    } catch (...) {
+      profile_performance = profile;
+      autotuning_ = false;
+      throw;
+    }
+    profile_performance = profile;
+    autotuning_ = false;
+    // evaluating the Jacobian may have switched to the exact Jacobian
+    tuning_file_ = tuning_filename();
+    tuning.save(tuning_filename(), "Tuning of \"" + name_ + "\" on " +
+                                       std::to_string(num_samples) +
+                                       " samples");
+    std::cout << "Saved tuning of \"" << name_ << "\" to "
+              << tuning_filename() << ".\n";
+    return tuning;
+  }
+
   void operator()(const std::vector<std::vector<BaseScalar>> &local_inputs,
                   std::vector<std::vector<BaseScalar>> &outputs,
                   const std::vector<BaseScalar> &global_input) override {
+    load_or_autotune(local_inputs, global_input, false);
     outputs.resize(local_inputs.size());
     if (target_ == TARGET_CPU) {
       assert(!library_name_.empty());
@@ -209,91 +621,384 @@ class GeneratedCodeGen : public GeneratedBase {
         o.resize(output_dim_);
       }
       int num_tasks = static_cast<int>(local_inputs.size());
-#pragma omp parallel for
-      for (int i = 0; i < num_tasks; ++i) {
-        if (global_input.empty()) {
-          auto model = get_cpu_model();
-          model->ForwardZero(local_inputs[i], outputs[i]);
-        } else {
-          static thread_local std::vector<BaseScalar> input;
-          input = global_input;
-          input.resize(global_input.size() + local_inputs[0].size());
-          for (size_t j = 0; j < local_inputs[i].size(); ++j) {
-            input[j + global_input.size()] = local_inputs[i][j];
+      const int num_threads = tuning.forward.threads();
+      const int chunk = tuning.forward.chunk(num_tasks);
+#pragma omp parallel num_threads(num_threads)
+      {
+        ScopedPerfCounters perf(perf_report(), "forward_batch", 0, 0);
+#pragma omp for schedule(static, chunk) nowait
+        for (int i = 0; i < num_tasks; ++i) {
+          if (global_input.empty()) {
+            auto model = get_cpu_model();
+            model->ForwardZero(local_inputs[i], outputs[i]);
+          } else {
+            static thread_local std::vector<BaseScalar> input;
+            input = global_input;
+            input.resize(global_input.size() + local_inputs[0].size());
+            for (size_t j = 0; j < local_inputs[i].size(); ++j) {
+              input[j + global_input.size()] = local_inputs[i][j];
+            }
+            auto model = get_cpu_model();
+            model->ForwardZero(input, outputs[i]);
           }
-          auto model = get_cpu_model();
-          model->ForwardZero(input, outputs[i]);
         }
       }
     } else if (target_ == TARGET_CUDA) {
+      ScopedPerfCounters perf(perf_report(), "forward_batch", 0, 0);
       const auto &model = get_cuda_model();
-      model.forward_zero(&outputs, local_inputs, num_gpu_threads_per_block,
-                         global_input);
+      model.forward_zero(&outputs, local_inputs,
+                         gpu_block_size(tuning.forward), global_input);
     }
+    count_call("forward_batch", local_inputs.size());
   }
 
   void jacobian(const std::vector<BaseScalar> &input,
                 std::vector<BaseScalar> &output) override {
+    ScopedPerfCounters perf(perf_report(), "jacobian", 1);
     if (target_ == TARGET_CPU) {
       assert(!library_name_.empty());
-      auto model = get_cpu_model();
-      model->Jacobian(input, output);
+      adopt_exact_jacobian();
+      if (!exact_jacobian_) {
+        // the perturbations are evaluated in parallel
+        finite_difference_jacobian_cpu(*get_cpu_model(), input, output, true);
+        return;
+      }
+      get_cpu_jacobian_model()->Jacobian(input, output);
     } else if (target_ == TARGET_CUDA) {
       const auto &model = get_cuda_model();
       model.jacobian(input, output);
     }
   }
 
+  /**
+   * Single-sample Jacobian that hands the buffers directly to the compiled
+   * CPU function (finite-difference Jacobians and CUDA models copy the
+   * buffers).
+   */
+  void jacobian(const BaseScalar *input, BaseScalar *output) override {
+    adopt_exact_jacobian();
+    if (target_ != TARGET_CPU || !exact_jacobian_) {
+      GeneratedBase::jacobian(input, output);
+      return;
+    }
+    GenericModelPtr model = get_cpu_jacobian_model();
+    ScopedPerfCounters perf(perf_report(), "jacobian", 1);
+    const std::size_t n = static_cast<std::size_t>(input_dim());
+    model->Jacobian(
+        CppAD::cg::ArrayView<const BaseScalar>(input, n),
+        CppAD::cg::ArrayView<BaseScalar>(output, n * output_dim_));
+  }
+
   void jacobian(const std::vector<std::vector<BaseScalar>> &local_inputs,
                 std::vector<std::vector<BaseScalar>> &outputs,
                 const std::vector<BaseScalar> &global_input) override {
+    load_or_autotune(local_inputs, global_input, true);
     outputs.resize(local_inputs.size());
     if (target_ == TARGET_CPU) {
       assert(!library_name_.empty());
       for (auto &o : outputs) {
         o.resize(input_dim() * output_dim_);
       }
+      adopt_exact_jacobian();
+      if (!exact_jacobian_) {
+        jacobian_batch_fd_cpu(local_inputs, outputs, global_input);
+        count_call("jacobian_batch", local_inputs.size());
+        return;
+      }
       int num_tasks = static_cast<int>(local_inputs.size());
-#pragma omp parallel for
-      for (int i = 0; i < num_tasks; ++i) {
-        if (global_input.empty()) {
-          auto model = get_cpu_model();
-          // model->ForwardZero(local_inputs[i], outputs[i]);
-          model->Jacobian(local_inputs[i], outputs[i]);
-        } else {
-          static thread_local std::vector<BaseScalar> input;
-          if (input.empty()) {
-            input.resize(global_input.size());
-            input.insert(input.begin(), global_input.begin(),
-                         global_input.end());
-          }
-          for (size_t j = 0; j < local_inputs[i].size(); ++j) {
-            input[j + global_input.size()] = local_inputs[i][j];
+      const int num_threads = tuning.jacobian.threads();
+      const int chunk = tuning.jacobian.chunk(num_tasks);
+#pragma omp parallel num_threads(num_threads)
+      {
+        ScopedPerfCounters perf(perf_report(), "jacobian_batch", 0, 0);
+#pragma omp for schedule(static, chunk) nowait
+        for (int i = 0; i < num_tasks; ++i) {
+          if (global_input.empty()) {
+            auto model = get_cpu_jacobian_model();
+            // model->ForwardZero(local_inputs[i], outputs[i]);
+            model->Jacobian(local_inputs[i], outputs[i]);
+          } else {
+            static thread_local std::vector<BaseScalar> input;
+            input = global_input;
+            input.resize(global_input.size() + local_inputs[i].size());
+            for (size_t j = 0; j < local_inputs[i].size(); ++j) {
+              input[j + global_input.size()] = local_inputs[i][j];
+            }
+            auto model = get_cpu_jacobian_model();
+            model->Jacobian(input, outputs[i]);
           }
-          auto model = get_cpu_model();
-          model->Jacobian(input, outputs[i]);
         }
       }
     } else if (target_ == TARGET_CUDA) {
+      ScopedPerfCounters perf(perf_report(), "jacobian_batch", 0, 0);
       const auto &model = get_cuda_model();
-      model.jacobian(&outputs, local_inputs, num_gpu_threads_per_block,
+      model.jacobian(&outputs, local_inputs, gpu_block_size(tuning.jacobian),
                      global_input);
     }
+    count_call("jacobian_batch", local_inputs.size());
+  }
+
+  /**
+   * Vectorized forward pass on flat buffers. Compiled CPU functions read the
+   * inputs from and write the outputs to the buffers directly if the layout is
+   * AoS, otherwise each sample is gathered and scattered by the thread that
+   * evaluates it (CUDA models copy the buffers).
+   */
+  void forward_batch(std::size_t num_samples, const BaseScalar *local_inputs,
+                     BaseScalar *outputs, const BatchLayout &layout,
+                     const std::vector<BaseScalar> &global_input) override {
+    if (target_ != TARGET_CPU) {
+      GeneratedBase::forward_batch(num_samples, local_inputs, outputs, layout,
+                                   global_input);
+      return;
+    }
+    load_tuning();
+    const std::size_t n = static_cast<std::size_t>(input_dim());
+    GenericModelPtr cpu_model = get_cpu_model();
+    evaluate_layout_cpu(
+        *cpu_model, num_samples, local_inputs, outputs, output_dim_, layout,
+        {}, global_input, tuning.forward, "forward_batch",
+        [&](GenericModel &model, const BaseScalar *input, BaseScalar *output) {
+          model.ForwardZero(
+              CppAD::cg::ArrayView<const BaseScalar>(input, n),
+              CppAD::cg::ArrayView<BaseScalar>(output, output_dim_));
+        });
+    count_call("forward_batch", num_samples);
+  }
+
+  /**
+   * Vectorized Jacobian pass on flat buffers (see `forward_batch`). The
+   * compiled function writes row-major Jacobians in AoS layout directly to
+   * the buffer, Jacobians in other layouts or in column-major order are
+   * copied per sample.
+   */
+  void jacobian_batch(std::size_t num_samples, const BaseScalar *local_inputs,
+                      BaseScalar *jacobians, const BatchLayout &layout,
+                      MatrixOrder order,
+                      const std::vector<BaseScalar> &global_input) override {
+    adopt_exact_jacobian();
+    if (target_ != TARGET_CPU || !exact_jacobian_) {
+      GeneratedBase::jacobian_batch(num_samples, local_inputs, jacobians,
+                                    layout, order, global_input);
+      return;
+    }
+    load_tuning();
+    const std::size_t n = static_cast<std::size_t>(input_dim());
+    const std::size_t m = static_cast<std::size_t>(output_dim_);
+    GenericModelPtr cpu_model = get_cpu_jacobian_model();
+    evaluate_layout_cpu(
+        *cpu_model, num_samples, local_inputs, jacobians, n * m, layout,
+        jacobian_positions(m, n, order), global_input, tuning.jacobian,
+        "jacobian_batch",
+        [&](GenericModel &model, const BaseScalar *input, BaseScalar *output) {
+          model.Jacobian(CppAD::cg::ArrayView<const BaseScalar>(input, n),
+                         CppAD::cg::ArrayView<BaseScalar>(output, n * m));
+        });
+    count_call("jacobian_batch", num_samples);
+  }
+
+  void operator()(const std::vector<InputGroup> &groups,
+                  GroupedOutputs &outputs) override {
+    load_tuning();
+    outputs.resize(groups.size());
+    if (target_ == TARGET_CPU) {
+      assert(!library_name_.empty());
+      GenericModelPtr cpu_model = get_cpu_model();
+      evaluate_groups_cpu(*cpu_model, groups, outputs, output_dim_,
+                          tuning.forward, "forward_grouped",
+                          [](GenericModel &model,
+                             const std::vector<BaseScalar> &input,
+                             std::vector<BaseScalar> &output) {
+                            model.ForwardZero(input, output);
+                          });
+    } else if (target_ == TARGET_CUDA) {
+      // the kernel holds a single global input buffer, so the groups are
+      // launched one after another
+      ScopedPerfCounters perf(perf_report(), "forward_grouped", 0, 0);
+      const auto &model = get_cuda_model();
+      for (size_t g = 0; g < groups.size(); ++g) {
+        model.forward_zero(&outputs[g], groups[g].local_inputs,
+                           gpu_block_size(tuning.forward),
+                           groups[g].global_input);
+      }
+    }
+    count_call("forward_grouped", num_samples(groups));
+  }
+
+  void jacobian(const std::vector<InputGroup> &groups,
+                GroupedOutputs &outputs) override {
+    load_tuning();
+    outputs.resize(groups.size());
+    if (target_ == TARGET_CPU) {
+      assert(!library_name_.empty());
+      adopt_exact_jacobian();
+      const bool exact = exact_jacobian_;
+      GenericModelPtr cpu_model =
+          exact ? get_cpu_jacobian_model() : get_cpu_model();
+      evaluate_groups_cpu(*cpu_model, groups, outputs,
+                          input_dim() * output_dim_, tuning.jacobian,
+                          "jacobian_grouped",
+                          [this, exact](GenericModel &model,
+                                        const std::vector<BaseScalar> &input,
+                                        std::vector<BaseScalar> &output) {
+                            if (exact) {
+                              model.Jacobian(input, output);
+                            } else {
+                              finite_difference_jacobian_cpu(model, input,
+                                                             output, false);
+                            }
+                          });
+    } else if (target_ == TARGET_CUDA) {
+      ScopedPerfCounters perf(perf_report(), "jacobian_grouped", 0, 0);
+      const auto &model = get_cuda_model();
+      for (size_t g = 0; g < groups.size(); ++g) {
+        model.jacobian(&outputs[g], groups[g].local_inputs,
+                       gpu_block_size(tuning.jacobian), groups[g].global_input);
+      }
+    }
+    count_call("jacobian_grouped", num_samples(groups));
+  }
+
+  void rollout(
+      const std::vector<BaseScalar> &x0, const std::vector<BaseScalar> &params,
+      int num_steps, std::vector<BaseScalar> &final_state,
+      std::vector<std::vector<BaseScalar>> *trajectory = nullptr) override {
+    if (target_ != TARGET_CPU) {
+      GeneratedBase::rollout(x0, params, num_steps, final_state, trajectory);
+      return;
+    }
+    assert(!library_name_.empty());
+    check_num_steps(num_steps);
+    check_rollout_dims(x0, params);
+    final_state.resize(output_dim_);
+    GenericModelPtr model = get_cpu_model();
+    ScopedPerfCounters perf(perf_report(), "rollout",
+                            static_cast<std::size_t>(num_steps));
+    rollout_cpu(*model, x0, params, num_steps, final_state, trajectory);
+  }
+
+  void rollout(const std::vector<std::vector<BaseScalar>> &x0s,
+               const std::vector<BaseScalar> &params, int num_steps,
+               std::vector<std::vector<BaseScalar>> &final_states,
+               std::vector<std::vector<std::vector<BaseScalar>>> *trajectories =
+                   nullptr) override {
+    if (target_ != TARGET_CPU) {
+      GeneratedBase::rollout(x0s, params, num_steps, final_states,
+                             trajectories);
+      return;
+    }
+    assert(!library_name_.empty());
+    check_num_steps(num_steps);
+    final_states.resize(x0s.size());
+    if (trajectories) {
+      trajectories->resize(x0s.size());
+    }
+    for (const auto &x0 : x0s) {
+      check_rollout_dims(x0, params);
+    }
+    load_tuning();
+    GenericModelPtr model = get_cpu_model();
+    int num_tasks = static_cast<int>(x0s.size());
+    const int num_threads = tuning.forward.threads();
+    const int chunk = tuning.forward.chunk(num_tasks);
+#pragma omp parallel num_threads(num_threads)
+    {
+      ScopedPerfCounters perf(perf_report(), "rollout_batch", 0, 0);
+#pragma omp for schedule(static, chunk) nowait
+      for (int i = 0; i < num_tasks; ++i) {
+        final_states[i].resize(output_dim_);
+        rollout_cpu(*model, x0s[i], params, num_steps, final_states[i],
+                    trajectories ? &(*trajectories)[i] : nullptr);
+      }
+    }
+    count_call("rollout_batch",
+               x0s.size() * static_cast<std::size_t>(num_steps));
   }
 
   void compile_cpu() {
+    wait_for_jacobian_upgrade();
+    assert_traces_available();
+    const bool fd_jacobian = finite_difference_jacobian && generate_jacobian;
+    separate_jacobian_ = lazy_jacobian && generate_jacobian;
+    library_name_ = compile_cpu_library(name_ + "_cpu", true,
+                                        !fd_jacobian && !separate_jacobian_);
+    exact_jacobian_ = !fd_jacobian && !separate_jacobian_;
+    exact_jacobian_pending_ = false;
+    {
+      std::lock_guard<std::mutex> lock(cpu_library_loading_mutex_);
+      jacobian_library_name_ = "";
+      jacobian_cpu_model_ = nullptr;
+      jacobian_cpu_models_.clear();
+      jacobian_cpu_library_.reset();
+    }
+    target_ = TARGET_CPU;
+    const bool compile_in_background =
+        separate_jacobian_ ? background_jacobian
+                           : fd_jacobian && upgrade_to_exact_jacobian;
+    if (compile_in_background) {
+      // the thread holds the code generation lock for the whole compilation,
+      // so that the traces and the compiler cannot be changed meanwhile;
+      // wait until it has the lock before returning
+      std::promise<void> locked;
+      std::future<void> has_lock = locked.get_future();
+      const std::size_t generation = library_generation_;
+      jacobian_upgrade_ = std::thread(
+          [this, generation, locked = std::move(locked)]() mutable {
+            std::lock_guard<std::recursive_mutex> lock(
+                CodeGenData<BaseScalar>::codegen_mutex);
+            locked.set_value();
+            try {
+              upgraded_library_name_ = compile_exact_jacobian_library();
+              upgraded_generation_ = generation;
+              exact_jacobian_pending_ = true;
+            } catch (const std::exception &e) {
+              std::cerr << "Failed to compile the exact Jacobian of \""
+                        << name_ << "\": " << e.what() << "\n";
+            }
+          });
+      has_lock.wait();
+    }
+  }
+
+  /**
+   * Compiles the library that provides the exact Jacobian after the forward
+   * library: the separate Jacobian library if `lazy_jacobian` is active,
+   * otherwise a library with both the forward pass and the Jacobian.
+   */
+  std::string compile_exact_jacobian_library() {
+    if (separate_jacobian_) {
+      return compile_cpu_library(name_ + "_cpu_jacobian", false, true);
+    }
+    return compile_cpu_library(name_ + "_cpu_exact", true, true);
+  }
+
+  /**
+   * Generates and compiles the CPU library `library_name` (with or without
+   * the forward pass and the Jacobian of the main function) and returns the
+   * path to load it from. If `static_archive` is set, a static archive is
+   * created instead of a shared library (see `compile_static_library()`).
+   */
+  std::string compile_cpu_library(const std::string &library_name,
+                                  bool create_forward, bool create_jacobian,
+                                  bool static_archive = false) {
     using namespace CppAD;
     using namespace CppAD::cg;
 
+    std::lock_guard<std::recursive_mutex> lock(
+        CodeGenData<BaseScalar>::codegen_mutex);
+    assert_traces_available();
+
     ModelCSourceGen<BaseScalar> main_source_gen(*(main_trace_.tape), name_);
-    main_source_gen.setCreateForwardZero(generate_forward);
-    main_source_gen.setCreateJacobian(generate_jacobian);
+    main_source_gen.setCreateForwardZero(generate_forward && create_forward);
+    main_source_gen.setCreateJacobian(create_jacobian);
+    if (!related_dependents.empty()) {
+      main_source_gen.setRelatedDependents(related_dependents);
+    }
     ModelLibraryCSourceGen<BaseScalar> libcgen(main_source_gen);
-    // reverse order of invocation to first generate code for innermost
-    // functions
-    const auto &order = *CodeGenData<BaseScalar>::invocation_order;
+    // generate code for innermost functions first
+    const auto order = CodeGenData<BaseScalar>::dependency_order();
     std::list<ModelCSourceGen<BaseScalar> *> models;
-    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    for (auto it = order.begin(); it != order.end(); ++it) {
       FunctionTrace<BaseScalar> &trace =
           (*CodeGenData<BaseScalar>::traces)[*it];
       // trace.tape->optimize();
@@ -301,15 +1006,26 @@ class GeneratedCodeGen : public GeneratedBase {
       source_gen->setCreateForwardZero(generate_forward);
       // source_gen->setCreateSparseJacobian(generate_jacobian);
       // source_gen->setCreateJacobian(generate_jacobian);
-      source_gen->setCreateForwardOne(generate_jacobian);
-      source_gen->setCreateReverseOne(generate_jacobian);
+      source_gen->setCreateForwardOne(create_jacobian);
+      source_gen->setCreateReverseOne(create_jacobian);
       models.push_back(source_gen);
       // we need a stable reference
       libcgen.addModel(*(models.back()));
     }
     libcgen.setVerbose(true);
 
-    DynamicModelLibraryProcessor<BaseScalar> p(libcgen);
+    // generate the sources of all functions up front, the library generator
+    // then collects the cached sources in its own (deterministic) order
+    std::vector<ModelCSourceGen<BaseScalar> *> jobs(models.begin(),
+                                                    models.end());
+    jobs.push_back(&main_source_gen);
+    std::vector<std::set<std::string>> tapes;
+    for (auto *job : jobs) {
+      tapes.push_back(CodeGenData<BaseScalar>::used_tapes(job->getName()));
+    }
+    run_codegen_jobs<BaseScalar>(tapes, codegen_threads(), [&](std::size_t i) {
+      jobs[i]->getSources(MultiThreadingType::NONE, nullptr);
+    });
 
     // if (clang_path.empty()) {
     //   clang_path = autogen::find_exe("clang", false);
@@ -328,79 +1044,284 @@ class GeneratedCodeGen : public GeneratedBase {
       set_cpu_compiler_clang();
 #endif
     }
-    cpu_compiler->setSourcesFolder(name_ + "_cpu_srcs");
-    cpu_compiler->setTemporaryFolder(name_ + "_cpu_tmp");
+    cpu_compiler->setSourcesFolder(library_name + "_srcs");
+    cpu_compiler->setTemporaryFolder(library_name + "_tmp");
     cpu_compiler->setSaveToDiskFirst(true);
+    // the compiler is shared by all libraries of this function, so the flags
+    // of this library are restored afterwards
+    const std::vector<std::string> base_flags = cpu_compiler->getCompileFlags();
+    std::vector<std::string> flags = base_flags;
     if (debug_mode) {
-      cpu_compiler->addCompileFlag("-g");
-      cpu_compiler->addCompileFlag("-O0");
+      flags.push_back("-g");
+      flags.push_back("-O0");
     } else {
-      cpu_compiler->addCompileFlag("-O" + std::to_string(optimization_level));
+      flags.push_back("-O" + std::to_string(optimization_level));
+      if (annotate_sources) {
+        flags.push_back("-g");
+        flags.push_back("-fno-omit-frame-pointer");
+      }
     }
-    p.setLibraryName(name_ + "_cpu");
-    bool load_library = false;  // we do this in another step
-    p.createDynamicLibrary(*cpu_compiler, load_library);
-    library_name_ = "./" + name_ + "_cpu";
-    target_ = TARGET_CPU;
+    cpu_compiler->setCompileFlags(flags);
+    std::string library_path = "./" + library_name;
+    try {
+      if (static_archive) {
+        library_path = create_static_archive(library_name, jobs, libcgen);
+      } else {
+        DynamicModelLibraryProcessor<BaseScalar> p(libcgen);
+        p.setLibraryName(library_name);
+        bool load_library = false;  // we do this in another step
+        p.createDynamicLibrary(*cpu_compiler, load_library);
+        compile_isa_variants(library_name, libcgen);
+      }
+    } catch (...) {
+      cpu_compiler->setCompileFlags(base_flags);
+      throw;
+    }
+    cpu_compiler->setCompileFlags(base_flags);
+
+    if (annotate_sources) {
+      // the atomic functions are called through function pointers in the
+      // CPU library and therefore always remain separate symbols
+      std::map<std::string, std::vector<std::string>> model_sources;
+      for (auto *job : jobs) {
+        auto &files = model_sources[job->getName()];
+        for (const auto &[file, source] :
+             job->getSources(MultiThreadingType::NONE, nullptr)) {
+          files.push_back(file);
+        }
+      }
+      write_symbol_map(library_name, library_name + "_srcs", model_sources);
+    }
+    return library_path;
+  }
+
+  /**
+   * Compiles the ISA variants (see `isa_variants`) of the shared CPU library
+   * `library_name` from the sources generated for it and writes the manifest
+   * of the variants that compiled successfully (a variant whose flags the
+   * compiler does not support is skipped).
+   */
+  void compile_isa_variants(
+      const std::string &library_name,
+      CppAD::cg::ModelLibraryCSourceGen<BaseScalar> &libcgen) {
+    // a stale manifest would select variants of a previous compilation
+    std::filesystem::remove(isa_manifest_filename(library_name));
+    if (isa_variants.empty()) {
+      return;
+    }
+    const std::vector<std::string> base_flags = cpu_compiler->getCompileFlags();
+    std::vector<IsaVariant> compiled;
+    for (const auto &variant : isa_variants) {
+      const std::string variant_library =
+          isa_library_name(library_name, variant.name);
+      std::vector<std::string> flags = base_flags;
+      flags.insert(flags.end(), variant.compile_flags.begin(),
+                   variant.compile_flags.end());
+      cpu_compiler->setCompileFlags(flags);
+      cpu_compiler->setTemporaryFolder(variant_library + "_tmp");
+      try {
+        CppAD::cg::DynamicModelLibraryProcessor<BaseScalar> p(libcgen);
+        p.setLibraryName(variant_library);
+        p.createDynamicLibrary(*cpu_compiler, false);
+        compiled.push_back(variant);
+      } catch (const std::exception &e) {
+        std::cerr << "Skipping the " << variant.name << " variant of \""
+                  << library_name << "\": " << e.what() << "\n";
+      }
+    }
+    cpu_compiler->setCompileFlags(base_flags);
+    cpu_compiler->setTemporaryFolder(library_name + "_tmp");
+    write_isa_manifest(library_name, compiled);
+  }
+
+  /**
+   * Compiles the generated sources of the CPU library with the configured
+   * compiler and bundles them together with the registration function of the
+   * library in the static archive "lib<library_name>.a". The functions of the
+   * library are renamed to "<registration function>_<function>", so that the
+   * archives of several libraries can be linked into the same executable.
+   */
+  std::string create_static_archive(
+      const std::string &library_name,
+      const std::vector<CppAD::cg::ModelCSourceGen<BaseScalar> *> &models,
+      CppAD::cg::ModelLibraryCSourceGen<BaseScalar> &libcgen) const {
+#if AUTOGEN_SYSTEM_WIN
+    throw std::runtime_error(
+        "Static CPU libraries are only supported with GCC and Clang.");
+#else
+    using LibraryGen = CppAD::cg::ModelLibraryCSourceGen<BaseScalar>;
+    std::map<std::string, std::string> sources = libcgen.getLibrarySources();
+    std::set<std::string> model_names;
+    for (auto *model : models) {
+      const auto &model_sources =
+          model->getSources(CppAD::cg::MultiThreadingType::NONE, nullptr);
+      sources.insert(model_sources.begin(), model_sources.end());
+      model_names.insert(model->getName());
+    }
+    // the functions the model library looks up in addition to those of the
+    // models
+    const std::set<std::string> library_functions{
+        LibraryGen::FUNCTION_VERSION, LibraryGen::FUNCTION_MODELS,
+        LibraryGen::FUNCTION_ONCLOSE,
+        LibraryGen::FUNCTION_SETTHREADPOOLDISABLED,
+        LibraryGen::FUNCTION_ISTHREADPOOLDISABLED,
+        LibraryGen::FUNCTION_SETTHREADS, LibraryGen::FUNCTION_GETTHREADS,
+        LibraryGen::FUNCTION_SETTHREADSCHEDULERSTRAT,
+        LibraryGen::FUNCTION_GETTHREADSCHEDULERSTRAT,
+        LibraryGen::FUNCTION_SETTHREADPOOLVERBOSE,
+        LibraryGen::FUNCTION_ISTHREADPOOLVERBOSE,
+        LibraryGen::FUNCTION_SETTHREADPOOLGUIDEDMAXGROUPWORK,
+        LibraryGen::FUNCTION_SETTHREADPOOLNUMBEROFTIMEMEAS};
+    const std::set<std::string> functions =
+        static_library_functions(sources, library_functions, model_names);
+    const std::string symbol = static_library_symbol(library_name);
+    add_static_registration(symbol, functions, sources);
+
+    // the caller restores the compile flags
+    std::vector<std::string> flags = cpu_compiler->getCompileFlags();
+    for (const auto &function : functions) {
+      flags.push_back("-D" + function + "=" + symbol + "_" + function);
+    }
+    cpu_compiler->setCompileFlags(flags);
+    // the archive may be linked into position-independent executables
+    cpu_compiler->compileSources(sources, true);
+
+    const std::string archive = "lib" + library_name + ".a";
+    std::filesystem::remove(archive);
+    CppAD::cg::ArArchiver ar(autogen::find_exe("ar"));
+    ar.create(archive, cpu_compiler->getObjectFiles());
+    cpu_compiler->cleanup();
+    std::cout << "Created static CPU library " << archive
+              << " (registration function " << symbol << ")\n";
+    return "./" + library_name;
+#endif
   }
 
   mutable std::mutex cpu_library_loading_mutex_{};
 
+  // whether the exact Jacobian is available from the compiled CPU libraries
+  std::atomic<bool> exact_jacobian_{true};
+  // whether the Jacobian is compiled into a separate library
+  bool separate_jacobian_{false};
+  // background compilation of the exact Jacobian
+  std::thread jacobian_upgrade_;
+  std::atomic<bool> exact_jacobian_pending_{false};
+  std::string upgraded_library_name_;
+  // incremented by `discard_library()`, a background compilation started for
+  // an earlier generation of the library is not adopted
+  std::size_t library_generation_{0};
+  std::size_t upgraded_generation_{0};
+
   GenericModelPtr get_cpu_model() const {
+    std::lock_guard<std::mutex> lock(cpu_library_loading_mutex_);
+    return load_cpu_model();
+  }
+
+  /**
+   * Model that evaluates the Jacobian, i.e. the main model of the separate
+   * Jacobian library if there is one (see `lazy_jacobian`).
+   */
+  GenericModelPtr get_cpu_jacobian_model() const {
+    std::lock_guard<std::mutex> lock(cpu_library_loading_mutex_);
+    return load_cpu_jacobian_model();
+  }
+
+  // the callers hold `cpu_library_loading_mutex_`, which guards the loaded
+  // libraries against being swapped by `adopt_exact_jacobian()`
+  GenericModelPtr load_cpu_model() const {
     if (!cpu_library_) {
-      cpu_library_loading_mutex_.lock();
-      cpu_library_ = std::make_shared<DynamicLib>(library_name_ + library_ext_);
-      std::set<std::string> model_names = cpu_library_->getModelNames();
-      std::cout << "Successfully loaded CPU library "
-                << library_name_ + library_ext_ << std::endl;
-      for (auto &name : model_names) {
-        std::cout << "  Found model " << name << std::endl;
-      }
-      // load and wire up atomic functions in this library
-      const auto &order = *CodeGenData<BaseScalar>::invocation_order;
-      const auto &hierarchy = CodeGenData<BaseScalar>::call_hierarchy;
-      cpu_models_[name_] =
-          GenericModelPtr(cpu_library_->model(name_).release());
-      if (!cpu_models_[name_]) {
-        throw std::runtime_error("Failed to load model from library " +
-                                 library_name_ + library_ext_);
-      }
-      // atomic functions to be added
-      typedef std::pair<std::string, std::string> ParentChild;
-      std::set<ParentChild> remaining_atomics;
-      for (const std::string &s :
-           cpu_models_[name_]->getAtomicFunctionNames()) {
-        remaining_atomics.insert(std::make_pair(name_, s));
-      }
-      while (!remaining_atomics.empty()) {
-        ParentChild member = *(remaining_atomics.begin());
-        const std::string &parent = member.first;
-        const std::string &atomic_name = member.second;
-        remaining_atomics.erase(remaining_atomics.begin());
-        if (cpu_models_.find(atomic_name) == cpu_models_.end()) {
-          std::cout << "  Adding atomic function " << atomic_name << std::endl;
-          cpu_models_[atomic_name] =
-              GenericModelPtr(cpu_library_->model(atomic_name).release());
-          for (const std::string &s :
-               cpu_models_[atomic_name]->getAtomicFunctionNames()) {
-            remaining_atomics.insert(std::make_pair(atomic_name, s));
-          }
+      load_cpu_library(library_name_, cpu_library_, cpu_models_);
+      cpu_model_ = cpu_models_[name_].get();
+    }
+    return cpu_models_[name_];
+  }
+  GenericModelPtr load_cpu_jacobian_model() const {
+    if (jacobian_library_name_.empty()) {
+      return load_cpu_model();
+    }
+    if (!jacobian_cpu_library_) {
+      load_cpu_library(jacobian_library_name_, jacobian_cpu_library_,
+                       jacobian_cpu_models_);
+      jacobian_cpu_model_ = jacobian_cpu_models_[name_].get();
+    }
+    return jacobian_cpu_models_[name_];
+  }
+
+  /**
+   * Loads the CPU library `library_name` (a static library if it has been
+   * registered, otherwise a shared library) and wires up the models of the
+   * atomic functions.
+   */
+  void load_cpu_library(
+      const std::string &library_name,
+      std::shared_ptr<CppAD::cg::FunctorModelLibrary<BaseScalar>> &library,
+      std::map<std::string, GenericModelPtr> &models) const {
+    const auto registration = StaticLibraryRegistry::find(
+        std::filesystem::path(library_name).filename().string());
+    if (registration) {
+      library = std::make_shared<StaticModelLibrary<BaseScalar>>(registration);
+      std::cout << "Successfully loaded static CPU library " << library_name
+                << std::endl;
+    } else {
+      // the best ISA variant the CPU supports, if the library has variants
+      const std::string variant = select_isa_variant(library_name);
+      const std::string filename =
+          isa_library_name(library_name, variant) + library_ext_;
+      library = std::make_shared<DynamicLib>(filename);
+      std::cout << "Successfully loaded CPU library " << filename;
+      if (!variant.empty()) {
+        std::cout << " (" << variant << " variant)";
+      }
+      std::cout << std::endl;
+    }
+    std::set<std::string> model_names = library->getModelNames();
+    for (auto &name : model_names) {
+      std::cout << "  Found model " << name << std::endl;
+    }
+    // load and wire up atomic functions in this library
+    const auto &order = *CodeGenData<BaseScalar>::invocation_order;
+    const auto &hierarchy = CodeGenData<BaseScalar>::call_hierarchy;
+    models[name_] = GenericModelPtr(library->model(name_).release());
+    if (!models[name_]) {
+      throw std::runtime_error("Failed to load model from library " +
+                               library_name + library_ext_);
+    }
+    // atomic functions to be added
+    typedef std::pair<std::string, std::string> ParentChild;
+    std::set<ParentChild> remaining_atomics;
+    for (const std::string &s : models[name_]->getAtomicFunctionNames()) {
+      remaining_atomics.insert(std::make_pair(name_, s));
+    }
+    while (!remaining_atomics.empty()) {
+      ParentChild member = *(remaining_atomics.begin());
+      const std::string &parent = member.first;
+      const std::string &atomic_name = member.second;
+      remaining_atomics.erase(remaining_atomics.begin());
+      if (models.find(atomic_name) == models.end()) {
+        std::cout << "  Adding atomic function " << atomic_name << std::endl;
+        models[atomic_name] =
+            GenericModelPtr(library->model(atomic_name).release());
+        for (const std::string &s :
+             models[atomic_name]->getAtomicFunctionNames()) {
+          remaining_atomics.insert(std::make_pair(atomic_name, s));
         }
-        auto &atomic_model = cpu_models_[atomic_name];
-        cpu_models_[parent]->addAtomicFunction(atomic_model->asAtomic());
       }
-
-      std::cout << "Loaded compiled model \"" << name_ << "\" from \""
-                << library_name_ << "\".\n";
-      cpu_library_loading_mutex_.unlock();
+      auto &atomic_model = models[atomic_name];
+      models[parent]->addAtomicFunction(atomic_model->asAtomic());
     }
-    return cpu_models_[name_];
+
+    std::cout << "Loaded compiled model \"" << name_ << "\" from \""
+              << library_name << "\".\n";
   }
 
   void compile_cuda() {
     using namespace CppAD;
     using namespace CppAD::cg;
 
+    std::lock_guard<std::recursive_mutex> lock(
+        CodeGenData<BaseScalar>::codegen_mutex);
+    assert_traces_available();
+
     std::cout << "Compiling CUDA code...\n";
 
     std::cout << "Invocation order: ";
@@ -414,13 +1335,23 @@ class GeneratedCodeGen : public GeneratedBase {
     main_source_gen.setCreateJacobian(generate_jacobian);
     main_source_gen.global_input_dim() = global_input_dim_;
     main_source_gen.jacobian_acc_method() = jac_acc_method_;
-    CudaLibraryProcessor<BaseScalar> cuda_proc(&main_source_gen,
-                                               name_ + "_cuda");
-    // reverse order of invocation to first generate code for innermost
-    // functions
-    const auto &order = *CodeGenData<BaseScalar>::invocation_order;
+    if (!related_dependents.empty()) {
+      if (global_input_dim_ == 0) {
+        main_source_gen.setRelatedDependents(related_dependents);
+      } else {
+        // the loops index the independent variables as one array, which
+        // the split into global and local input does not support
+        std::cout << "Skipping loop detection in the CUDA code of \""
+                  << name_ << "\" since it has a global input.\n";
+      }
+    }
+    const std::string library_name = cuda_library_name();
+    CudaLibraryProcessor<BaseScalar> cuda_proc(&main_source_gen, library_name);
+    // generate code for innermost functions first, since the CUDA device
+    // functions need to be defined before they are called
+    const auto order = CodeGenData<BaseScalar>::dependency_order();
     std::list<CudaModelSourceGen<BaseScalar> *> models;
-    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    for (auto it = order.begin(); it != order.end(); ++it) {
       std::cout << "Adding cuda model " << *it << "\n";
       FunctionTrace<BaseScalar> &trace =
           (*CodeGenData<BaseScalar>::traces)[*it];
@@ -432,12 +1363,20 @@ class GeneratedCodeGen : public GeneratedBase {
       cuda_proc.add_model(models.back(), false);
     }
     cuda_proc.debug_mode() = debug_mode;
+    cuda_proc.line_info() = annotate_sources;
+    cuda_proc.num_codegen_threads() = codegen_threads();
     cuda_proc.generate_code();
     cuda_proc.save_sources();
     cuda_proc.optimization_level() = optimization_level;
     cuda_proc.create_library();
+    if (annotate_sources) {
+      write_symbol_map(library_name, cuda_proc.src_dir().string(),
+                       cuda_proc.model_sources());
+    }
 
-    library_name_ = name_ + "_cuda";
+    library_name_ = library_name;
+    cuda_library_ = nullptr;
+    cuda_libraries_[global_input_dim_] = {library_name_, nullptr};
 
     for (auto *model : models) {
       delete model;
@@ -445,6 +1384,111 @@ class GeneratedCodeGen : public GeneratedBase {
     target_ = TARGET_CUDA;
   }
 
+  /**
+   * Compiles the CPU code of the function to the static archive
+   * "lib<library_name>.a" (`library_name` defaults to the name of the
+   * function followed by "_static") that can be linked into an executable,
+   * which avoids the symbol lookup at load time and the indirect calls
+   * through the procedure linkage table of a shared library, and lets the
+   * linker optimize across the generated code. The archive contains the
+   * registration function `autogen_register_<library_name>`; after
+   * `AUTOGEN_REGISTER_STATIC_LIBRARY(<library_name>)` in a source file of the
+   * executable, `load_precompiled_library("<library_name>")` uses the linked
+   * code instead of loading a shared library. Returns the path of the
+   * archive.
+   */
+  std::string compile_static_library(std::string library_name = "") {
+    wait_for_jacobian_upgrade();
+    assert_traces_available();
+    if (library_name.empty()) {
+      library_name = name_ + "_static";
+    }
+    compile_cpu_library(library_name, true, generate_jacobian, true);
+    return "lib" + library_name + ".a";
+  }
+
+  /**
+   * Writes the forward pass and, if `generate_jacobian` is set, the row-major
+   * Jacobian of the function (including all atomic functions it calls) to a
+   * self-contained C++ header that can be compiled into an application
+   * without loading a library at runtime and without depending on CppAD or
+   * CppADCodeGen. The header provides the following functions with
+   * dimensions known at compile time in namespace `ns` (defaults to the name
+   * of the function):
+   *
+   *   constexpr std::size_t input_dim, output_dim;
+   *   void forward(const std::array<Float, input_dim> &input,
+   *                std::array<Float, output_dim> &output);
+   *   void jacobian(const std::array<Float, input_dim> &input,
+   *                 std::array<Float, output_dim * input_dim> &jacobian);
+   */
+  void export_header(const std::string &filename, std::string ns = "") const {
+    std::lock_guard<std::recursive_mutex> lock(
+        CodeGenData<BaseScalar>::codegen_mutex);
+    assert_traces_available();
+    if (ns.empty()) {
+      ns = name_;
+    }
+
+    // the code is generated by the CUDA code generator where every model is
+    // a device function that calls the functions of its atomics directly
+    CudaModelSourceGen<BaseScalar> main_source_gen(*(main_trace_.tape), name_);
+    main_source_gen.setCreateForwardZero(true);
+    main_source_gen.setCreateJacobian(generate_jacobian);
+    main_source_gen.jacobian_acc_method() = ACCUMULATE_NONE;
+    main_source_gen.set_kernel_only(true);
+    if (!related_dependents.empty()) {
+      main_source_gen.setRelatedDependents(related_dependents);
+    }
+    CudaLibraryProcessor<BaseScalar> proc(&main_source_gen, name_ + "_aot",
+                                          false);
+    std::list<std::unique_ptr<CudaModelSourceGen<BaseScalar>>> models;
+    for (const auto &atomic : CodeGenData<BaseScalar>::dependency_order()) {
+      FunctionTrace<BaseScalar> &trace =
+          (*CodeGenData<BaseScalar>::traces)[atomic];
+      models.push_back(std::make_unique<CudaModelSourceGen<BaseScalar>>(
+          *(trace.tape), atomic, true));
+      models.back()->setCreateForwardOne(generate_jacobian);
+      models.back()->setCreateReverseOne(generate_jacobian);
+      proc.add_model(models.back().get(), false);
+    }
+    proc.num_codegen_threads() = codegen_threads();
+    proc.generate_code();
+
+    const std::size_t input_dim = main_trace_.tape->Domain();
+    const std::size_t output_dim = main_trace_.tape->Range();
+    std::ofstream file(filename);
+    if (!file) {
+      throw std::runtime_error("Could not write header file \"" + filename +
+                               "\".");
+    }
+    file << "// Generated by autogen from function \"" << name_
+         << "\", do not edit.\n";
+    file << "#pragma once\n\n#include <array>\n#include <cmath>\n"
+         << "#include <cstddef>\n\n";
+    file << "namespace " << ns << " {\n";
+    file << "typedef " << main_source_gen.base_type_name() << " Float;\n\n";
+    file << "constexpr std::size_t input_dim = " << input_dim << ";\n";
+    file << "constexpr std::size_t output_dim = " << output_dim << ";\n\n";
+    file << "namespace detail {\n";
+    file << HostSourceAssembler<BaseScalar>(proc).assemble();
+    file << "}  // namespace detail\n\n";
+    file << "inline void forward(const std::array<Float, input_dim> &input,\n"
+         << "                    std::array<Float, output_dim> &output) {\n"
+         << "  detail::" << name_
+         << "_forward_zero(output.data(), input.data());\n}\n";
+    if (generate_jacobian) {
+      file << "\ninline void jacobian(\n"
+           << "    const std::array<Float, input_dim> &input,\n"
+           << "    std::array<Float, output_dim * input_dim> &jacobian) {\n"
+           << "  detail::" << name_
+           << "_jacobian(jacobian.data(), input.data());\n}\n";
+    }
+    file << "}  // namespace " << ns << "\n";
+    std::cout << "Exported \"" << name_ << "\" to header " << filename
+              << "\n";
+  }
+
   const CudaModel<BaseScalar> &get_cuda_model() const {
     if (!cuda_library_) {
       cuda_library_ = std::make_shared<CudaLibrary<BaseScalar>>(library_name_);
@@ -452,6 +1496,496 @@ class GeneratedCodeGen : public GeneratedBase {
     return cuda_library_->get_model(name_);
   }
 
+ protected:
+  /**
+   * Evaluates `fun` on all samples of all groups within a single parallel
+   * region. Each thread assembles the global part of its input buffer only
+   * when it moves on to a sample from a different group.
+   */
+  template <typename EvalFun>
+  void evaluate_groups_cpu(GenericModel &model,
+                           const std::vector<InputGroup> &groups,
+                           GroupedOutputs &outputs, int sample_output_dim,
+                           const TuningConfig &config, const char *entry_point,
+                           EvalFun fun) {
+    // flatten (group, sample) pairs so that one dispatch covers all groups
+    std::vector<std::pair<int, int>> tasks;
+    for (size_t g = 0; g < groups.size(); ++g) {
+      outputs[g].resize(groups[g].local_inputs.size());
+      for (size_t i = 0; i < groups[g].local_inputs.size(); ++i) {
+        outputs[g][i].resize(sample_output_dim);
+        tasks.emplace_back(static_cast<int>(g), static_cast<int>(i));
+      }
+    }
+    if (tasks.empty()) {
+      return;
+    }
+    int num_tasks = static_cast<int>(tasks.size());
+    const int num_threads = config.threads();
+    const int chunk = config.chunk(num_tasks);
+#pragma omp parallel num_threads(num_threads)
+    {
+      ScopedPerfCounters perf(perf_report(), entry_point, 0, 0);
+      std::vector<BaseScalar> input;
+      int current_group = -1;
+#pragma omp for schedule(static, chunk) nowait
+      for (int t = 0; t < num_tasks; ++t) {
+        const int g = tasks[t].first;
+        const int i = tasks[t].second;
+        const auto &global_input = groups[g].global_input;
+        const auto &local_input = groups[g].local_inputs[i];
+        if (g != current_group) {
+          input.resize(global_input.size() + local_input.size());
+          std::copy(global_input.begin(), global_input.end(), input.begin());
+          current_group = g;
+        }
+        std::copy(local_input.begin(), local_input.end(),
+                  input.begin() + global_input.size());
+        fun(model, input, outputs[g][i]);
+      }
+    }
+  }
+
+  /**
+   * Evaluates `fun(model, input, output)` on all samples of a batch stored in
+   * flat buffers, where `output` holds the `sample_output_dim` results of a
+   * sample that are stored at positions `positions` (see `scatter_sample`).
+   * Inputs and results are only copied if they are not stored contiguously
+   * in the buffers.
+   */
+  template <typename EvalFun>
+  void evaluate_layout_cpu(GenericModel &model, std::size_t num_samples,
+                           const BaseScalar *local_inputs, BaseScalar *outputs,
+                           std::size_t sample_output_dim,
+                           const BatchLayout &layout,
+                           const std::vector<std::size_t> &positions,
+                           const std::vector<BaseScalar> &global_input,
+                           const TuningConfig &config, const char *entry_point,
+                           EvalFun fun) {
+    const std::size_t gd = global_input.size();
+    const std::size_t ld = static_cast<std::size_t>(input_dim()) - gd;
+    const bool aos = layout.type == LAYOUT_AOS;
+    const bool direct_input = aos && gd == 0;
+    const bool direct_output = aos && positions.empty();
+    const std::size_t stride = layout.stride(num_samples);
+    const int num_tasks = static_cast<int>(num_samples);
+    const int num_threads = config.threads();
+    const int chunk = config.chunk(num_tasks);
+#pragma omp parallel num_threads(num_threads)
+    {
+      ScopedPerfCounters perf(perf_report(), entry_point, 0, 0);
+      std::vector<BaseScalar> input(global_input), output;
+      input.resize(gd + ld);
+      if (!direct_output) {
+        output.resize(sample_output_dim);
+      }
+#pragma omp for schedule(static, chunk) nowait
+      for (int t = 0; t < num_tasks; ++t) {
+        const std::size_t s = static_cast<std::size_t>(t);
+        const BaseScalar *local_input =
+            local_inputs + layout.offset(s, num_samples, ld);
+        if (!direct_input) {
+          for (std::size_t i = 0; i < ld; ++i) {
+            input[gd + i] = local_input[i * stride];
+          }
+        }
+        if (direct_output) {
+          fun(model, direct_input ? local_input : input.data(),
+              outputs + s * sample_output_dim);
+        } else {
+          fun(model, direct_input ? local_input : input.data(), output.data());
+          scatter_sample(s, num_samples, sample_output_dim, output.data(),
+                         outputs, layout, positions);
+        }
+      }
+    }
+  }
+
+  /**
+   * Switches to the library with the exact Jacobian once its background
+   * compilation has finished. The separate Jacobian library (see
+   * `lazy_jacobian`) is compiled now unless it is being compiled in the
+   * background and the Jacobian can be approximated in the meantime.
+   */
+  void adopt_exact_jacobian() {
+    if (exact_jacobian_ || target_ != TARGET_CPU) {
+      return;
+    }
+    if (!exact_jacobian_pending_) {
+      if (!separate_jacobian_ ||
+          (jacobian_upgrade_.joinable() && finite_difference_jacobian)) {
+        return;
+      }
+      wait_for_jacobian_upgrade();
+      if (!exact_jacobian_pending_ ||
+          upgraded_generation_ != library_generation_) {
+        upgraded_library_name_ = compile_exact_jacobian_library();
+        upgraded_generation_ = library_generation_;
+        exact_jacobian_pending_ = true;
+      }
+    }
+    wait_for_jacobian_upgrade();
+    if (upgraded_generation_ != library_generation_) {
+      // compiled for a library that has been discarded since
+      exact_jacobian_pending_ = false;
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(cpu_library_loading_mutex_);
+      if (separate_jacobian_) {
+        // the forward library remains loaded
+        jacobian_cpu_model_ = nullptr;
+        jacobian_cpu_models_.clear();
+        jacobian_cpu_library_.reset();
+        jacobian_library_name_ = upgraded_library_name_;
+      } else {
+        cpu_model_ = nullptr;
+        cpu_models_.clear();
+        cpu_library_.reset();
+        library_name_ = upgraded_library_name_;
+      }
+      exact_jacobian_ = true;
+      exact_jacobian_pending_ = false;
+    }
+    std::cout << "Switched \"" << name_
+              << "\" to the exact Jacobian from library \""
+              << upgraded_library_name_ << "\".\n";
+    if (release_traces_after_jacobian) {
+      release_traces_after_jacobian = false;
+      release_traces();
+      CodeGenData<BaseScalar>::release(name_);
+    }
+  }
+
+  /**
+   * Approximates the Jacobian (row-major, output dimension x input dimension)
+   * of the compiled zero-order forward function by finite differences. If
+   * `parallel` is true, the perturbed inputs are evaluated concurrently.
+   */
+  void finite_difference_jacobian_cpu(GenericModel &model,
+                                      const std::vector<BaseScalar> &input,
+                                      std::vector<BaseScalar> &output,
+                                      bool parallel) const {
+    const int n = static_cast<int>(input.size());
+    const std::size_t m = static_cast<std::size_t>(output_dim_);
+    output.resize(m * n);
+    std::vector<BaseScalar> nominal;
+    if (!central_differences) {
+      nominal.resize(m);
+      model.ForwardZero(input, nominal);
+    }
+    const BaseScalar *nominal_y = nominal.data();
+    const BaseScalar eps = finite_diff_eps;
+    const bool central = central_differences;
+#pragma omp parallel for if (parallel)
+    for (int j = 0; j < n; ++j) {
+      static thread_local std::vector<BaseScalar> x, right_y, left_y;
+      x.assign(input.begin(), input.end());
+      right_y.resize(m);
+      x[j] = input[j] + eps;
+      model.ForwardZero(x, right_y);
+      if (central) {
+        left_y.resize(m);
+        x[j] = input[j] - eps;
+        model.ForwardZero(x, left_y);
+        for (std::size_t i = 0; i < m; ++i) {
+          output[i * n + j] = (right_y[i] - left_y[i]) / (2 * eps);
+        }
+      } else {
+        for (std::size_t i = 0; i < m; ++i) {
+          output[i * n + j] = (right_y[i] - nominal_y[i]) / eps;
+        }
+      }
+    }
+  }
+
+  void jacobian_batch_fd_cpu(
+      const std::vector<std::vector<BaseScalar>> &local_inputs,
+      std::vector<std::vector<BaseScalar>> &outputs,
+      const std::vector<BaseScalar> &global_input) {
+    GenericModelPtr model = get_cpu_model();
+    int num_tasks = static_cast<int>(local_inputs.size());
+    const int num_threads = tuning.jacobian.threads();
+    const int chunk = tuning.jacobian.chunk(num_tasks);
+#pragma omp parallel num_threads(num_threads)
+    {
+      ScopedPerfCounters perf(perf_report(), "jacobian_batch", 0, 0);
+      std::vector<BaseScalar> input(global_input);
+#pragma omp for schedule(static, chunk) nowait
+      for (int i = 0; i < num_tasks; ++i) {
+        input.resize(global_input.size());
+        input.insert(input.end(), local_inputs[i].begin(),
+                     local_inputs[i].end());
+        finite_difference_jacobian_cpu(*model, input, outputs[i], false);
+      }
+    }
+  }
+
+  /**
+   * Writes the symbol map of the library, one line per generated source file
+   * with the function it defines (the file name without extension), the
+   * traced function it belongs to, and where that function is called.
+   */
+  void write_symbol_map(
+      const std::string &library_name, const std::string &sources_folder,
+      const std::map<std::string, std::vector<std::string>> &model_sources)
+      const {
+    const auto &traces = *CodeGenData<BaseScalar>::traces;
+    const auto &mapped = CodeGenData<BaseScalar>::mapped_atomics;
+    std::map<std::string, std::set<std::string>> callers;
+    for (const auto &[caller, callees] :
+         CodeGenData<BaseScalar>::call_hierarchy) {
+      for (const auto &callee : callees) {
+        callers[callee].insert(caller);
+      }
+    }
+
+    const std::string filename = library_name + "_symbols.txt";
+    std::ofstream file(filename);
+    if (!file) {
+      throw std::runtime_error("Could not write symbol map \"" + filename +
+                               "\".");
+    }
+    file << "# symbol\ttraced function\tkind\tcalled by\tcall site\t"
+            "source file\n";
+    for (const auto &[model, files] : model_sources) {
+      std::string kind = "main";
+      std::string called_by = "-";
+      std::string call_site = "-";
+      const auto trace = traces.find(model);
+      if (trace != traces.end()) {
+        kind = "atomic";
+        const auto map = mapped.find(model);
+        if (map != mapped.end()) {
+          kind = "map(" + map->second.element_name + ", " +
+                 std::to_string(map->second.num_elements) + ")";
+        }
+        // atomic functions without recorded callers are called by the main
+        // function
+        called_by = name_;
+        const auto it = callers.find(model);
+        if (it != callers.end()) {
+          called_by.clear();
+          for (const auto &caller : it->second) {
+            called_by += (called_by.empty() ? "" : ",") + caller;
+          }
+        }
+        if (!trace->second.source_file.empty()) {
+          call_site = trace->second.source_file + ":" +
+                      std::to_string(trace->second.source_line);
+        }
+      }
+      for (const auto &src : files) {
+        const std::string symbol = src.substr(0, src.find_last_of('.'));
+        file << symbol << "\t" << model << "\t" << kind << "\t" << called_by
+             << "\t" << call_site << "\t" << sources_folder << "/" << src
+             << "\n";
+      }
+    }
+    std::cout << "Saved symbol map at " << filename << "\n";
+  }
+
+  std::string cuda_library_name() const {
+    if (global_input_dim_ == 0) {
+      return name_ + "_cuda";
+    }
+    return name_ + "_cuda_global" + std::to_string(global_input_dim_);
+  }
+
+  std::size_t codegen_threads() const {
+    if (num_codegen_threads > 0) {
+      return static_cast<std::size_t>(num_codegen_threads);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  PerfCounterReport *perf_report() {
+    return profile_performance ? &perf_report_ : nullptr;
+  }
+
+  // the tuning file lies next to the library and is named after the function
+  // and the way its Jacobian is evaluated ("cuda" for CUDA libraries), since
+  // the compiled library names change whenever the Jacobian is upgraded
+  std::string tuning_filename() const {
+    std::string jacobian_mode = "cuda";
+    if (target_ == TARGET_CPU) {
+      jacobian_mode = exact_jacobian_      ? "exact"
+                      : separate_jacobian_ ? "lazy"
+                                           : "fd";
+    }
+    const std::size_t slash = library_name_.find_last_of("/\\");
+    const std::string directory =
+        slash == std::string::npos ? "" : library_name_.substr(0, slash + 1);
+    return directory + name_ + "_" + jacobian_mode + "_tuning.txt";
+  }
+
+  int gpu_block_size(const TuningConfig &config) const {
+    return config.gpu_threads_per_block > 0 ? config.gpu_threads_per_block
+                                            : num_gpu_threads_per_block;
+  }
+
+  // loads the tuning file at the first batched evaluation of the library and
+  // whenever the Jacobian mode changes, the default settings are used if
+  // there is none
+  void load_tuning() {
+    std::lock_guard<std::recursive_mutex> lock(tuning_mutex_);
+    if (autotuning_ || library_name_.empty()) {
+      return;
+    }
+    const std::string filename = tuning_filename();
+    if (tuning_file_ == filename) {
+      return;
+    }
+    tuning_file_ = filename;
+    if (!tuning.load(filename)) {
+      // the settings of a previous library do not apply
+      tuning = TuningResult();
+      return;
+    }
+    std::cout << "Loaded tuning of \"" << name_ << "\" from " << filename
+              << ".\n";
+  }
+
+  // loads the tuning of the library at its first batched evaluation or, if
+  // the evaluated pass has not been tuned and `autotune_on_first_use` is set,
+  // tunes that pass on the batch
+  void load_or_autotune(
+      const std::vector<std::vector<BaseScalar>> &local_inputs,
+      const std::vector<BaseScalar> &global_input, bool jacobian) {
+    std::lock_guard<std::recursive_mutex> lock(tuning_mutex_);
+    load_tuning();
+    if (autotuning_ || library_name_.empty() || !autotune_on_first_use ||
+        local_inputs.empty()) {
+      return;
+    }
+    if (jacobian && !tuning.jacobian_tuned) {
+      autotune(local_inputs, global_input, false, true);
+    } else if (!jacobian && !tuning.forward_tuned) {
+      autotune(local_inputs, global_input, true, false);
+      tuned_on_first_use_ = true;
+    }
+  }
+
+  // sets `config` to the fastest of the candidate configurations of `eval`
+  template <typename EvalFun>
+  void tune(const std::vector<TuningConfig> &candidates, TuningConfig &config,
+            EvalFun eval) {
+    using clock = std::chrono::steady_clock;
+    TuningConfig best = config;
+    double best_time = std::numeric_limits<double>::infinity();
+    for (const auto &candidate : candidates) {
+      config = candidate;
+      // the first run also compiles or loads the library if necessary
+      eval();
+      for (int r = 0; r < std::max(autotune_repetitions, 1); ++r) {
+        // small batches take less than the resolution of a single
+        // measurement, so they are repeated for at least the minimum time
+        const auto start = clock::now();
+        std::chrono::nanoseconds elapsed{0};
+        int runs = 0;
+        do {
+          eval();
+          ++runs;
+          elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              clock::now() - start);
+        } while (static_cast<double>(elapsed.count()) * 1e-9 <
+                 autotune_min_time);
+        const double time = static_cast<double>(elapsed.count()) * 1e-9 / runs;
+        if (time < best_time) {
+          best_time = time;
+          best = candidate;
+        }
+      }
+    }
+    config = best;
+  }
+
+  // records a call of a batched entry point whose counters are sampled by the
+  // worker threads
+  void count_call(const char *entry_point, std::size_t evaluations) {
+    if (profile_performance) {
+      PerfSample sample;
+      sample.calls = 1;
+      sample.evaluations = evaluations;
+      perf_report_.add(entry_point, sample);
+    }
+  }
+
+  static std::size_t num_samples(const std::vector<InputGroup> &groups) {
+    std::size_t n = 0;
+    for (const auto &group : groups) {
+      n += group.local_inputs.size();
+    }
+    return n;
+  }
+
+  void assert_traces_available() const {
+    if (!has_traces()) {
+      throw std::runtime_error(
+          "The traces of function \"" + name_ +
+          "\" have been released. Retrace the function to change how it is "
+          "compiled.");
+    }
+  }
+
+  void check_rollout_dims(const std::vector<BaseScalar> &x0,
+                          const std::vector<BaseScalar> &params) const {
+    if (output_dim_ != local_input_dim_ ||
+        static_cast<int>(x0.size()) != local_input_dim_ ||
+        static_cast<int>(params.size()) != global_input_dim_) {
+      throw std::runtime_error(
+          "Rollout of \"" + name_ +
+          "\" requires the state dimension to match the local input and "
+          "output dimension (" +
+          std::to_string(local_input_dim_) + " and " +
+          std::to_string(output_dim_) +
+          "), and the parameter dimension to match the global input "
+          "dimension (" +
+          std::to_string(global_input_dim_) +
+          "). Provided were a state of dimension " +
+          std::to_string(x0.size()) + " and parameters of dimension " +
+          std::to_string(params.size()) + ".");
+    }
+  }
+
+  /**
+   * Iterates the compiled step function on two thread-local buffers that
+   * both hold the parameters followed by the state, so that no memory is
+   * allocated or copied between steps. The steps are driven from the host,
+   * one call of the compiled forward function per step.
+   */
+  static void rollout_cpu(GenericModel &model,
+                          const std::vector<BaseScalar> &x0,
+                          const std::vector<BaseScalar> &params, int num_steps,
+                          std::vector<BaseScalar> &final_state,
+                          std::vector<std::vector<BaseScalar>> *trajectory) {
+    using CppAD::cg::ArrayView;
+    const std::size_t pd = params.size();
+    const std::size_t sd = x0.size();
+    static thread_local std::vector<BaseScalar> buffers[2];
+    for (auto &buffer : buffers) {
+      buffer.resize(pd + sd);
+      std::copy(params.begin(), params.end(), buffer.begin());
+    }
+    std::copy(x0.begin(), x0.end(), buffers[0].begin() + pd);
+    if (trajectory) {
+      trajectory->resize(num_steps);
+    }
+    int current = 0;
+    for (int t = 0; t < num_steps; ++t) {
+      BaseScalar *next_state = buffers[1 - current].data() + pd;
+      model.ForwardZero(
+          ArrayView<const BaseScalar>(buffers[current].data(), pd + sd),
+          ArrayView<BaseScalar>(next_state, sd));
+      if (trajectory) {
+        (*trajectory)[t].assign(next_state, next_state + sd);
+      }
+      current = 1 - current;
+    }
+    std::copy(buffers[current].begin() + pd, buffers[current].end(),
+              final_state.begin());
+  }
+
  private:
 #if AUTOGEN_SYSTEM_WIN
   static const inline std::string library_ext_ = ".dll";
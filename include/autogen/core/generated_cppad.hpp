@@ -1,7 +1,9 @@
 #pragma once
 
 // clang-format off
+#include <algorithm>
 #include <functional>
+#include <string>
 
 #include <cppad/cg.hpp>
 #include <cppad/cg/arithmetic.hpp>
@@ -18,10 +20,29 @@ class GeneratedCppAD : public GeneratedBase {
   using ADScalar = typename CppAD::AD<BaseScalar>;
   using Functor = typename std::function<void(const std::vector<ADScalar>&,
                                               std::vector<ADScalar>&)>;
+  using SizeVector = std::vector<std::size_t>;
+  using ValueVector = std::vector<BaseScalar>;
+  // CppAD's vector type allocates from the thread-local memory pools of
+  // CppAD::thread_alloc
+  using FlatVector = CppAD::vector<BaseScalar>;
 
  private:
   std::shared_ptr<CppAD::ADFun<BaseScalar>> tape_{nullptr};
 
+  // Jacobian sparsity pattern (entries in row-major order) and the CppAD
+  // work object that caches the coloring between calls
+  bool jac_sparsity_computed_{false};
+  bool jac_forward_mode_{true};
+  CppAD::sparse_rc<SizeVector> jac_pattern_;
+  CppAD::sparse_rcv<SizeVector, ValueVector> jac_subset_;
+  CppAD::sparse_jac_work jac_work_;
+  CsrPattern jac_csr_pattern_;
+
+  // input buffers that are reused across calls
+  FlatVector x_flat_;
+  ValueVector sparse_input_;
+  bool taylor_reserved_{false};
+
   std::vector<ADScalar> ax_;
   std::vector<ADScalar> ay_;
 
@@ -33,6 +54,24 @@ class GeneratedCppAD : public GeneratedBase {
   using GeneratedBase::output_dim_;
 
  public:
+  /**
+   * Whether to compute the Jacobian via CppAD's sparse Jacobian drivers
+   * (`sparse_jac_for` if the function has at most as many inputs as outputs,
+   * `sparse_jac_rev` otherwise). The sparsity pattern and the graph coloring
+   * are computed at the first call and reused afterwards.
+   */
+  bool use_sparse_jacobian{false};
+
+  /**
+   * Coloring algorithm used by the sparse Jacobian ("cppad" or "colpack").
+   */
+  std::string sparse_jacobian_coloring{"cppad"};
+
+  /**
+   * Maximum number of colors that are evaluated at once by `sparse_jac_for`.
+   */
+  std::size_t sparse_jacobian_group_max{1};
+
   GeneratedCppAD(const std::vector<ADScalar>& ax,
                  const std::vector<ADScalar>& ay) {
     tape_ = std::make_shared<CppAD::ADFun<BaseScalar>>();
@@ -47,61 +86,112 @@ class GeneratedCppAD : public GeneratedBase {
     conditionally_trace_(input);
   }
 
+  using GeneratedBase::operator();
+  using GeneratedBase::jacobian;
+
   void clear() {
     tape_.reset();
     ax_.clear();
     ay_.clear();
     ADScalar::abort_recording();
+    jac_sparsity_computed_ = false;
+    taylor_reserved_ = false;
   }
 
   void operator()(const std::vector<BaseScalar>& input,
                   std::vector<BaseScalar>& output) override {
     conditionally_trace_(input);
-    output = tape_->Forward(0, input);
+    load_input_(input.data(), input.size());
+    output.resize(tape_->Range());
+    forward_(output.data());
+  }
+
+  /**
+   * Evaluates the forward pass on raw buffers that hold as many entries as
+   * the traced function has inputs and outputs.
+   */
+  void operator()(const BaseScalar* input, BaseScalar* output) override {
+    assert_traced_();
+    load_input_(input, tape_->Domain());
+    forward_(output);
   }
 
   void operator()(const std::vector<std::vector<BaseScalar>>& local_inputs,
                   std::vector<std::vector<BaseScalar>>& outputs,
                   const std::vector<BaseScalar>& global_input) override {
-    if (global_input.empty()) {
-      for (size_t i = 0; i < local_inputs.size(); ++i) {
-        outputs[i] = tape_->Forward(0, local_inputs[i]);
-      }
-    } else {
-      std::vector<BaseScalar> input(global_input);
-      input.resize(global_input.size() + local_inputs[0].size());
-      for (size_t i = 0; i < local_inputs.size(); ++i) {
-        for (size_t j = 0; j < local_inputs[i].size(); ++j) {
-          input[j + global_input.size()] = local_inputs[i][j];
-        }
-        outputs[i] = tape_->Forward(0, input);
-      }
+    assert_traced_();
+    outputs.resize(local_inputs.size());
+    for (size_t i = 0; i < local_inputs.size(); ++i) {
+      load_input_(global_input, local_inputs[i]);
+      outputs[i].resize(tape_->Range());
+      forward_(outputs[i].data());
     }
   }
 
   void jacobian(const std::vector<BaseScalar>& input,
                 std::vector<BaseScalar>& output) override {
     conditionally_trace_(input);
-    output = tape_->Jacobian(input);
+    load_input_(input.data(), input.size());
+    output.resize(tape_->Domain() * tape_->Range());
+    jacobian_(output.data());
+  }
+
+  /**
+   * Evaluates the row-major Jacobian on raw buffers that hold as many entries
+   * as the traced function has inputs and outputs times inputs.
+   */
+  void jacobian(const BaseScalar* input, BaseScalar* output) override {
+    assert_traced_();
+    load_input_(input, tape_->Domain());
+    jacobian_(output);
+  }
+
+  /**
+   * Returns the sparsity pattern of the Jacobian in CSR format, which
+   * determines the layout of the values returned by `sparse_jacobian()`.
+   */
+  const CsrPattern& jacobian_sparsity(const std::vector<BaseScalar>& input) {
+    conditionally_trace_(input);
+    compute_jacobian_sparsity_();
+    return jac_csr_pattern_;
+  }
+
+  /**
+   * Computes the nonzero entries of the Jacobian, ordered as defined by the
+   * CSR pattern returned by `jacobian_sparsity()`.
+   */
+  void sparse_jacobian(const std::vector<BaseScalar>& input,
+                       std::vector<BaseScalar>& values) {
+    conditionally_trace_(input);
+    evaluate_sparse_jacobian_(input);
+    values.assign(jac_subset_.val().begin(), jac_subset_.val().end());
+  }
+
+  /**
+   * Computes the nonzero entries of the Jacobians of a batch of inputs, where
+   * `values[i]` follows the CSR pattern returned by `jacobian_sparsity()`.
+   */
+  void sparse_jacobian(const std::vector<std::vector<BaseScalar>>& local_inputs,
+                       std::vector<std::vector<BaseScalar>>& values,
+                       const std::vector<BaseScalar>& global_input = {}) {
+    values.resize(local_inputs.size());
+    for (size_t i = 0; i < local_inputs.size(); ++i) {
+      sparse_input_.assign(global_input.begin(), global_input.end());
+      sparse_input_.insert(sparse_input_.end(), local_inputs[i].begin(),
+                           local_inputs[i].end());
+      sparse_jacobian(sparse_input_, values[i]);
+    }
   }
 
   void jacobian(const std::vector<std::vector<BaseScalar>>& local_inputs,
                 std::vector<std::vector<BaseScalar>>& outputs,
                 const std::vector<BaseScalar>& global_input) override {
+    assert_traced_();
     outputs.resize(local_inputs.size());
-    if (global_input.empty()) {
-      for (size_t i = 0; i < local_inputs.size(); ++i) {
-        jacobian(local_inputs[i], outputs[i]);
-      }
-    } else {
-      std::vector<BaseScalar> input(global_input.size());
-      input.insert(input.begin(), global_input.begin(), global_input.end());
-      for (size_t i = 0; i < local_inputs.size(); ++i) {
-        for (size_t j = 0; j < local_inputs[i].size(); ++i) {
-          input[j + global_input.size()] = local_inputs[i][j];
-        }
-        jacobian(input, outputs[i]);
-      }
+    for (size_t i = 0; i < local_inputs.size(); ++i) {
+      load_input_(global_input, local_inputs[i]);
+      outputs[i].resize(tape_->Domain() * tape_->Range());
+      jacobian_(outputs[i].data());
     }
   }
 
@@ -124,6 +214,144 @@ class GeneratedCppAD : public GeneratedBase {
     functor_(ax_, ay_);
     tape_ = std::make_shared<CppAD::ADFun<BaseScalar>>();
     tape_->Dependent(ax_, ay_);
+    jac_sparsity_computed_ = false;
+    taylor_reserved_ = false;
+  }
+
+  void assert_traced_() const {
+    if (!tape_) {
+      throw std::runtime_error(
+          "GeneratedCppAD cannot evaluate raw buffers before the function "
+          "has been traced.");
+    }
+  }
+
+  /**
+   * Reserves the Taylor coefficients of the tape once. CppAD's allocator
+   * setting is left to the application: with `autogen::set_hold_memory(true)`
+   * the memory that CppAD frees is kept in its thread-local pools, so that
+   * the temporary vectors allocated by `Forward` and `Jacobian` reuse it in
+   * subsequent calls.
+   */
+  void reserve_taylor_() {
+    if (taylor_reserved_) {
+      return;
+    }
+    // zero- and first-order coefficients (the latter are used by Jacobian)
+    tape_->capacity_order(2);
+    taylor_reserved_ = true;
+  }
+
+  void load_input_(const BaseScalar* input, std::size_t size) {
+    x_flat_.resize(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      x_flat_[i] = input[i];
+    }
+  }
+
+  void load_input_(const std::vector<BaseScalar>& global_input,
+                   const std::vector<BaseScalar>& local_input) {
+    const std::size_t global_dim = global_input.size();
+    x_flat_.resize(global_dim + local_input.size());
+    for (std::size_t i = 0; i < global_dim; ++i) {
+      x_flat_[i] = global_input[i];
+    }
+    for (std::size_t i = 0; i < local_input.size(); ++i) {
+      x_flat_[global_dim + i] = local_input[i];
+    }
+  }
+
+  void forward_(BaseScalar* output) {
+    reserve_taylor_();
+    const FlatVector y = tape_->Forward(0, x_flat_);
+    for (std::size_t i = 0; i < y.size(); ++i) {
+      output[i] = y[i];
+    }
+  }
+
+  // evaluates the row-major Jacobian at the loaded input
+  void jacobian_(BaseScalar* output) {
+    if (use_sparse_jacobian) {
+      sparse_input_.resize(x_flat_.size());
+      for (std::size_t i = 0; i < x_flat_.size(); ++i) {
+        sparse_input_[i] = x_flat_[i];
+      }
+      evaluate_sparse_jacobian_(sparse_input_);
+      scatter_sparse_jacobian_(output);
+      return;
+    }
+    reserve_taylor_();
+    const FlatVector jac = tape_->Jacobian(x_flat_);
+    for (std::size_t i = 0; i < jac.size(); ++i) {
+      output[i] = jac[i];
+    }
+  }
+
+  // writes the nonzero entries into the dense row-major Jacobian
+  void scatter_sparse_jacobian_(BaseScalar* output) const {
+    const auto& rows = jac_pattern_.row();
+    const auto& cols = jac_pattern_.col();
+    const auto& values = jac_subset_.val();
+    const std::size_t n = jac_pattern_.nc();
+    std::fill(output, output + jac_pattern_.nr() * n, BaseScalar(0));
+    for (std::size_t k = 0; k < values.size(); ++k) {
+      output[rows[k] * n + cols[k]] = values[k];
+    }
+  }
+
+  void compute_jacobian_sparsity_() {
+    if (jac_sparsity_computed_) {
+      return;
+    }
+    const std::size_t n = tape_->Domain();
+    const std::size_t m = tape_->Range();
+    jac_forward_mode_ = n <= m;
+    CppAD::sparse_rc<SizeVector> pattern;
+    if (jac_forward_mode_) {
+      CppAD::sparse_rc<SizeVector> identity(n, n, n);
+      for (std::size_t k = 0; k < n; ++k) {
+        identity.set(k, k, k);
+      }
+      tape_->for_jac_sparsity(identity, false, false, false, pattern);
+    } else {
+      CppAD::sparse_rc<SizeVector> identity(m, m, m);
+      for (std::size_t k = 0; k < m; ++k) {
+        identity.set(k, k, k);
+      }
+      tape_->rev_jac_sparsity(identity, false, false, false, pattern);
+    }
+    // store the entries in row-major order so that the computed values are
+    // laid out in CSR format
+    const SizeVector order = pattern.row_major();
+    jac_pattern_.resize(m, n, pattern.nnz());
+    for (std::size_t k = 0; k < order.size(); ++k) {
+      jac_pattern_.set(k, pattern.row()[order[k]], pattern.col()[order[k]]);
+    }
+    jac_subset_ = CppAD::sparse_rcv<SizeVector, ValueVector>(jac_pattern_);
+    jac_work_.clear();
+
+    jac_csr_pattern_.num_rows = m;
+    jac_csr_pattern_.num_cols = n;
+    jac_csr_pattern_.row_offsets.assign(m + 1, 0);
+    for (std::size_t k = 0; k < jac_pattern_.nnz(); ++k) {
+      ++jac_csr_pattern_.row_offsets[jac_pattern_.row()[k] + 1];
+    }
+    for (std::size_t i = 0; i < m; ++i) {
+      jac_csr_pattern_.row_offsets[i + 1] += jac_csr_pattern_.row_offsets[i];
+    }
+    jac_csr_pattern_.col_indices = jac_pattern_.col();
+    jac_sparsity_computed_ = true;
+  }
+
+  void evaluate_sparse_jacobian_(const std::vector<BaseScalar>& input) {
+    compute_jacobian_sparsity_();
+    if (jac_forward_mode_) {
+      tape_->sparse_jac_for(sparse_jacobian_group_max, input, jac_subset_,
+                            jac_pattern_, sparse_jacobian_coloring, jac_work_);
+    } else {
+      tape_->sparse_jac_rev(input, jac_subset_, jac_pattern_,
+                            sparse_jacobian_coloring, jac_work_);
+    }
   }
 };
 }  // namespace autogen
\ No newline at end of file
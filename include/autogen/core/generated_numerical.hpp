@@ -1,6 +1,7 @@
 #pragma once
 
 // clang-format off
+#include <complex>
 #include <vector>
 #include <functional>
 #include "base.hpp"
@@ -12,9 +13,14 @@ class GeneratedNumerical : public GeneratedBase {
   using Functor = typename std::function<void(const std::vector<BaseScalar> &,
                                               std::vector<BaseScalar> &)>;
   using ADScalar = double;
+  using ComplexScalar = std::complex<BaseScalar>;
+  using ComplexFunctor =
+      typename std::function<void(const std::vector<ComplexScalar> &,
+                                  std::vector<ComplexScalar> &)>;
 
  private:
   Functor functor_;
+  ComplexFunctor complex_functor_;
 
  protected:
   using GeneratedBase::global_input_dim_;
@@ -27,8 +33,29 @@ class GeneratedNumerical : public GeneratedBase {
    */
   double finite_diff_eps{1e-6};
 
+  /**
+   * Whether to compute the Jacobian via the complex-step method (requires a
+   * complex-valued instance of the function, see `set_complex_functor()`).
+   * Each column of the Jacobian is computed from a single evaluation without
+   * subtractive cancellation, so that the step size can be chosen tiny.
+   */
+  bool use_complex_step{false};
+
+  /**
+   * Step size to use for the complex-step method.
+   */
+  double complex_step_eps{1e-20};
+
   GeneratedNumerical(Functor functor) : functor_(functor) {}
 
+  void set_complex_functor(ComplexFunctor functor) {
+    complex_functor_ = functor;
+  }
+  bool has_complex_functor() const { return bool(complex_functor_); }
+
+  using GeneratedBase::operator();
+  using GeneratedBase::jacobian;
+
   void operator()(const std::vector<BaseScalar> &input,
                   std::vector<BaseScalar> &output) override {
     if (local_input_dim_ < 0) {
@@ -40,6 +67,18 @@ class GeneratedNumerical : public GeneratedBase {
     }
   }
 
+  /**
+   * The functor operates on vectors, hence the raw buffers are copied into
+   * per-thread vectors that are reused across calls.
+   */
+  void operator()(const BaseScalar *input, BaseScalar *output) override {
+    static thread_local std::vector<BaseScalar> x, y;
+    x.assign(input, input + input_dim());
+    y.resize(output_dim());
+    functor_(x, y);
+    std::copy(y.begin(), y.end(), output);
+  }
+
   void operator()(const std::vector<std::vector<BaseScalar>> &local_inputs,
                   std::vector<std::vector<BaseScalar>> &outputs,
                   const std::vector<BaseScalar> &global_input = {}) override {
@@ -65,6 +104,10 @@ class GeneratedNumerical : public GeneratedBase {
 
   void jacobian(const std::vector<BaseScalar> &input,
                 std::vector<BaseScalar> &output) override {
+    if (use_complex_step) {
+      complex_step_jacobian(input, output);
+      return;
+    }
     // central difference
     assert(output_dim() > 0);
     output.resize(input_dim() * output_dim());
@@ -83,6 +126,13 @@ class GeneratedNumerical : public GeneratedBase {
     }
   }
 
+  void jacobian(const BaseScalar *input, BaseScalar *output) override {
+    static thread_local std::vector<BaseScalar> x, jac;
+    x.assign(input, input + input_dim());
+    jacobian(x, jac);
+    std::copy(jac.begin(), jac.end(), output);
+  }
+
   void jacobian(const std::vector<std::vector<BaseScalar>> &local_inputs,
                 std::vector<std::vector<BaseScalar>> &outputs,
                 const std::vector<BaseScalar> &global_input = {}) override {
@@ -104,5 +154,27 @@ class GeneratedNumerical : public GeneratedBase {
     }
     return;
   }
+
+ protected:
+  void complex_step_jacobian(const std::vector<BaseScalar> &input,
+                             std::vector<BaseScalar> &output) {
+    if (!complex_functor_) {
+      throw std::runtime_error(
+          "The complex-step Jacobian requires a complex-valued instance of "
+          "the function, see `GeneratedNumerical::set_complex_functor()`.");
+    }
+    assert(output_dim() > 0);
+    output.resize(input_dim() * output_dim());
+    std::vector<ComplexScalar> x(input.begin(), input.end());
+    std::vector<ComplexScalar> y(output_dim());
+    for (size_t i = 0; i < input.size(); ++i) {
+      x[i].imag(complex_step_eps);
+      complex_functor_(x, y);
+      for (size_t j = 0; j < output_dim(); ++j) {
+        output[j * input_dim() + i] = y[j].imag() / complex_step_eps;
+      }
+      x[i].imag(0.);
+    }
+  }
 };
 }  // namespace autogen
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <map>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "../cuda/cuda_library_processor.hpp"
+
+namespace autogen {
+/**
+ * Assembles the code generated by `CudaLibraryProcessor` for kernel-only
+ * models (i.e. plain device functions without kernel launches) into host
+ * code. The generated files are inlined in the order in which the library
+ * includes them, and the device functions become inline C++ functions, so
+ * that the functions of atomic functions are called directly.
+ */
+template <typename Base>
+class HostSourceAssembler {
+ public:
+  explicit HostSourceAssembler(const CudaLibraryProcessor<Base> &processor) {
+    for (const auto &[filename, source] : processor.sources()) {
+      sources_[filename] = source;
+    }
+    main_file_ = processor.sources().back().first;
+  }
+
+  std::string assemble() {
+    std::ostringstream code;
+    included_.clear();
+    // the CUDA utilities and the model registry are not needed on the host
+    included_.insert("util.h");
+    included_.insert("model_info.h");
+    append(main_file_, code);
+    return code.str();
+  }
+
+ private:
+  std::map<std::string, std::string> sources_;
+  std::string main_file_;
+  std::set<std::string> included_;
+
+  void append(const std::string &filename, std::ostringstream &code) {
+    static const std::regex include_regex("^\\s*#include \"([^\"]+)\"\\s*$");
+    static const std::regex device_regex("\\b__device__\\b");
+    std::istringstream source(sources_.at(filename));
+    std::string line;
+    std::smatch match;
+    while (std::getline(source, line)) {
+      if (std::regex_match(line, match, include_regex) &&
+          sources_.find(match[1].str()) != sources_.end()) {
+        const std::string included_file = match[1].str();
+        if (included_.insert(included_file).second) {
+          append(included_file, code);
+        }
+        continue;
+      }
+      code << std::regex_replace(line, device_regex, "inline") << "\n";
+    }
+  }
+};
+}  // namespace autogen
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace autogen {
+/**
+ * Build of a CPU library for an instruction set extension. The variant is
+ * compiled with `compile_flags` in addition to the flags of the compiler and
+ * is only loaded on CPUs that support all of its `features` (names as
+ * accepted by `cpu_supports()`).
+ */
+struct IsaVariant {
+  std::string name;
+  std::vector<std::string> compile_flags;
+  std::vector<std::string> features;
+};
+
+/**
+ * Variants for x86-64 hosts with AVX-512 and with AVX2, in order of
+ * preference. Hosts without AVX2 fall back to the baseline library.
+ */
+inline std::vector<IsaVariant> default_isa_variants() {
+  return {{"avx512",
+           {"-mavx512f", "-mavx512dq", "-mavx512vl", "-mavx512bw", "-mfma",
+            "-mprefer-vector-width=512"},
+           {"avx512f", "avx512dq", "avx512vl", "avx512bw", "fma"}},
+          {"avx2", {"-mavx2", "-mfma"}, {"avx2", "fma"}}};
+}
+
+/**
+ * Whether the CPU the program runs on supports the instruction set extension
+ * `feature` (one of "sse4.2", "avx", "avx2", "fma", "avx512f", "avx512dq",
+ * "avx512vl", "avx512bw"). Unknown features and other architectures are
+ * reported as unsupported.
+ */
+inline bool cpu_supports(const std::string &feature) {
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+  // __builtin_cpu_supports only accepts string literals
+  __builtin_cpu_init();
+  const std::pair<const char *, bool> supported[] = {
+      {"sse4.2", __builtin_cpu_supports("sse4.2")},
+      {"avx", __builtin_cpu_supports("avx")},
+      {"avx2", __builtin_cpu_supports("avx2")},
+      {"fma", __builtin_cpu_supports("fma")},
+      {"avx512f", __builtin_cpu_supports("avx512f")},
+      {"avx512dq", __builtin_cpu_supports("avx512dq")},
+      {"avx512vl", __builtin_cpu_supports("avx512vl")},
+      {"avx512bw", __builtin_cpu_supports("avx512bw")}};
+  for (const auto &[name, is_supported] : supported) {
+    if (feature == name) {
+      return is_supported;
+    }
+  }
+#endif
+  return false;
+}
+
+inline std::string isa_manifest_filename(const std::string &library_name) {
+  return library_name + "_isa.txt";
+}
+
+/**
+ * Name of the file of `variant` of the library `library_name`.
+ */
+inline std::string isa_library_name(const std::string &library_name,
+                                    const std::string &variant) {
+  return variant.empty() ? library_name : library_name + "_" + variant;
+}
+
+/**
+ * Writes the manifest of the variants that have been compiled for the
+ * library `library_name`, one line per variant (in order of preference) with
+ * its name followed by the required CPU features.
+ */
+inline void write_isa_manifest(const std::string &library_name,
+                               const std::vector<IsaVariant> &variants) {
+  std::ofstream file(isa_manifest_filename(library_name));
+  if (!file) {
+    throw std::runtime_error("Could not write ISA manifest of library \"" +
+                             library_name + "\".");
+  }
+  for (const auto &variant : variants) {
+    file << variant.name;
+    for (const auto &feature : variant.features) {
+      file << " " << feature;
+    }
+    file << "\n";
+  }
+}
+
+/**
+ * Returns the first variant in the manifest of the library `library_name`
+ * that is supported by the CPU, or an empty string if the library has no
+ * manifest or the CPU supports none of its variants, in which case the
+ * baseline library is loaded.
+ */
+inline std::string select_isa_variant(const std::string &library_name) {
+  std::ifstream file(isa_manifest_filename(library_name));
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream stream(line);
+    std::string name, feature;
+    if (!(stream >> name)) {
+      continue;
+    }
+    bool supported = true;
+    while (stream >> feature) {
+      supported = supported && cpu_supports(feature);
+    }
+    if (supported) {
+      return name;
+    }
+  }
+  return "";
+}
+}  // namespace autogen
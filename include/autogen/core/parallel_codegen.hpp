@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cppad/cg.hpp>
+#include <exception>
+#include <list>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace autogen {
+namespace detail {
+// thread information handed to CppAD's thread_alloc while the source
+// generation jobs are running
+struct CodeGenThreadInfo {
+  static inline std::atomic<bool> in_parallel{false};
+  static inline thread_local std::size_t thread_num{0};
+  // whether the calling thread is running a code generation job
+  static inline thread_local bool in_job{false};
+  // CppAD requires the parallel setup to be done by the main thread
+  static inline const std::thread::id main_thread{std::this_thread::get_id()};
+  // serializes the runs of code generation jobs
+  static inline std::mutex mutex;
+  // CppAD has no getter for the hold_memory flag
+  static inline std::atomic<bool> hold_memory{false};
+
+  static bool is_in_parallel() { return in_parallel; }
+  static std::size_t get_thread_num() { return thread_num; }
+};
+}  // namespace detail
+
+/**
+ * Sets CppAD's `thread_alloc::hold_memory()` flag and records it, so that
+ * `run_codegen_jobs()` can restore it after the parallel jobs (which hold
+ * memory while running) have finished. Use this function instead of setting
+ * the flag on CppAD directly.
+ */
+inline void set_hold_memory(bool value) {
+  detail::CodeGenThreadInfo::hold_memory = value;
+  CppAD::thread_alloc::hold_memory(value);
+}
+
+/**
+ * Runs the code generation jobs `job(0)`, ..., `job(n-1)` (tracing or source
+ * generation) on up to `num_threads` threads, where `tapes[i]` contains the
+ * names of the tapes that job `i` evaluates or records (its own tape and the
+ * tapes of the atomic functions it calls). CppAD's ADFun is not thread-safe,
+ * so jobs that share a tape are never run at the same time. Jobs are started
+ * in the given order as soon as their tapes are free.
+ *
+ * Runs of jobs are serialized. CppAD's memory allocator is switched to
+ * multi-threaded mode while the jobs are running and switched back to its
+ * previous state afterwards. The jobs are run sequentially if the application
+ * has already set up CppAD for multi-threading, if the function is not called
+ * from the main thread (CppAD only allows the main thread to set up
+ * multi-threading) or if it is called from within a job.
+ */
+template <typename Base, typename Job>
+void run_codegen_jobs(const std::vector<std::set<std::string>> &tapes,
+                      std::size_t num_threads, Job job) {
+  using Info = detail::CodeGenThreadInfo;
+  const std::size_t num_jobs = tapes.size();
+  num_threads = std::min(num_threads, num_jobs);
+  auto run_sequentially = [&]() {
+    const bool was_in_job = Info::in_job;
+    Info::in_job = true;
+    try {
+      for (std::size_t i = 0; i < num_jobs; ++i) {
+        job(i);
+      }
+    } catch (...) {
+      Info::in_job = was_in_job;
+      throw;
+    }
+    Info::in_job = was_in_job;
+  };
+  if (Info::in_job) {
+    // nested in a job of a run that already holds the lock
+    run_sequentially();
+    return;
+  }
+  std::lock_guard<std::mutex> jobs_lock(Info::mutex);
+  if (num_threads <= 1 || std::this_thread::get_id() != Info::main_thread ||
+      CppAD::thread_alloc::num_threads() > 1 ||
+      CppAD::thread_alloc::in_parallel()) {
+    run_sequentially();
+    return;
+  }
+
+  const std::size_t previous_num_threads = CppAD::thread_alloc::num_threads();
+  CppAD::thread_alloc::parallel_setup(num_threads, &Info::is_in_parallel,
+                                      &Info::get_thread_num);
+  CppAD::thread_alloc::hold_memory(true);
+  CppAD::parallel_ad<Base>();
+  CppAD::parallel_ad<CppAD::cg::CG<Base>>();
+
+  std::mutex mutex;
+  std::condition_variable tapes_released;
+  std::list<std::size_t> pending;
+  for (std::size_t i = 0; i < num_jobs; ++i) {
+    pending.push_back(i);
+  }
+  std::set<std::string> busy_tapes;
+  std::exception_ptr error{nullptr};
+
+  auto worker = [&](std::size_t thread_num) {
+    Info::thread_num = thread_num;
+    Info::in_job = true;
+    while (true) {
+      std::size_t i;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto next = pending.end();
+        tapes_released.wait(lock, [&]() {
+          if (pending.empty() || error) {
+            return true;
+          }
+          next = std::find_if(pending.begin(), pending.end(), [&](auto j) {
+            return std::none_of(
+                tapes[j].begin(), tapes[j].end(),
+                [&](const auto &tape) { return busy_tapes.count(tape) > 0; });
+          });
+          return next != pending.end();
+        });
+        if (pending.empty() || error) {
+          break;
+        }
+        i = *next;
+        pending.erase(next);
+        busy_tapes.insert(tapes[i].begin(), tapes[i].end());
+      }
+      try {
+        job(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &tape : tapes[i]) {
+          busy_tapes.erase(tape);
+        }
+      }
+      tapes_released.notify_all();
+    }
+    Info::in_job = false;
+    CppAD::thread_alloc::free_available(thread_num);
+  };
+
+  Info::in_parallel = true;
+  std::vector<std::thread> threads;
+  for (std::size_t t = 1; t < num_threads; ++t) {
+    threads.emplace_back(worker, t);
+  }
+  worker(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  Info::in_parallel = false;
+
+  CppAD::thread_alloc::hold_memory(Info::hold_memory);
+  CppAD::thread_alloc::parallel_setup(previous_num_threads, nullptr, nullptr);
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+}  // namespace autogen
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <cctype>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cppad/cg.hpp>
+
+namespace autogen {
+/**
+ * Callback that receives the name and the address of a function of a
+ * statically linked CPU library.
+ */
+typedef void (*StaticLibraryFunctionCallback)(void *context, const char *name,
+                                              void *function);
+
+/**
+ * Registration function of a statically linked CPU library. It passes the
+ * names and addresses of all functions defined in the library to `add`,
+ * which take the place of the symbol lookup of a shared library.
+ */
+typedef void (*StaticLibraryRegistration)(StaticLibraryFunctionCallback add,
+                                          void *context);
+
+/**
+ * Name of the registration function of the static CPU library
+ * `library_name`.
+ */
+inline std::string static_library_symbol(const std::string &library_name) {
+  std::string symbol = "autogen_register_";
+  for (char c : library_name) {
+    symbol += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  }
+  return symbol;
+}
+
+/**
+ * Static CPU libraries that have been linked into the executable, see
+ * `AUTOGEN_REGISTER_STATIC_LIBRARY`.
+ */
+class StaticLibraryRegistry {
+ public:
+  static bool add(const std::string &library_name,
+                  StaticLibraryRegistration registration) {
+    libraries()[library_name] = registration;
+    return true;
+  }
+
+  static StaticLibraryRegistration find(const std::string &library_name) {
+    const auto it = libraries().find(library_name);
+    return it == libraries().end() ? nullptr : it->second;
+  }
+
+ private:
+  static std::map<std::string, StaticLibraryRegistration> &libraries() {
+    static std::map<std::string, StaticLibraryRegistration> registry;
+    return registry;
+  }
+};
+
+/**
+ * Whether `name` is a valid C identifier.
+ */
+inline bool is_c_identifier(const std::string &name) {
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) {
+    return false;
+  }
+  for (char c : name) {
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Functions of a static CPU library with the generated `sources` that are
+ * registered and renamed per archive. CppADCodeGen writes each function of a
+ * model, and each function of the library that the model library looks up,
+ * to a source file named after the function, so the functions are the names
+ * of the source files of the models `model_names` (which start with the name
+ * of the model) and the source files of `library_functions`.
+ */
+inline std::set<std::string> static_library_functions(
+    const std::map<std::string, std::string> &sources,
+    const std::set<std::string> &library_functions,
+    const std::set<std::string> &model_names) {
+  std::set<std::string> functions;
+  for (const auto &[filename, source] : sources) {
+    if (filename.size() < 2 ||
+        filename.compare(filename.size() - 2, 2, ".c") != 0) {
+      continue;
+    }
+    const std::string function = filename.substr(0, filename.size() - 2);
+    if (!is_c_identifier(function)) {
+      continue;
+    }
+    bool is_model_function = false;
+    for (const auto &model : model_names) {
+      if (function.compare(0, model.size() + 1, model + "_") == 0) {
+        is_model_function = true;
+        break;
+      }
+    }
+    if (is_model_function || library_functions.count(function) > 0) {
+      functions.insert(function);
+    }
+  }
+  return functions;
+}
+
+/**
+ * Adds the registration function `symbol` to the generated C sources of a
+ * static CPU library. Each of the `functions` (see
+ * `static_library_functions()`) is registered from its own source file,
+ * where its actual prototype is known; the registration function in the new
+ * file "<symbol>.c" calls these per-file functions.
+ */
+inline void add_static_registration(
+    const std::string &symbol, const std::set<std::string> &functions,
+    std::map<std::string, std::string> &sources) {
+  const std::string callback = "void (*add)(void *, const char *, void *)";
+  std::vector<std::string> parts;
+  for (const auto &function : functions) {
+    const std::string part = symbol + "_part" + std::to_string(parts.size());
+    std::ostringstream code;
+    code << "\n/* Registration of the function defined above, generated by "
+         << "autogen. */\n";
+    code << "void " << part << "(" << callback << ", void *context) {\n";
+    code << "  add(context, \"" << function << "\", (void *)" << function
+         << ");\n";
+    code << "}\n";
+    sources.at(function + ".c") += code.str();
+    parts.push_back(part);
+  }
+
+  std::ostringstream code;
+  code << "/* Generated by autogen, do not edit. */\n\n";
+  for (const auto &part : parts) {
+    code << "void " << part << "(" << callback << ", void *context);\n";
+  }
+  code << "\nvoid " << symbol << "(" << callback << ", void *context) {\n";
+  for (const auto &part : parts) {
+    code << "  " << part << "(add, context);\n";
+  }
+  code << "}\n";
+  sources[symbol + ".c"] = code.str();
+}
+
+template <class Base>
+class StaticModelLibrary;
+
+/**
+ * Model of a statically linked CPU library.
+ */
+template <class Base>
+class StaticModel : public CppAD::cg::FunctorGenericModel<Base> {
+  friend class StaticModelLibrary<Base>;
+
+ protected:
+  StaticModelLibrary<Base> *library_;
+
+  StaticModel(StaticModelLibrary<Base> *library, const std::string &name)
+      : CppAD::cg::FunctorGenericModel<Base>(name), library_(library) {
+    this->init(*library_);
+    library_->registerModel(*this);
+  }
+
+ public:
+  ~StaticModel() override {
+    if (library_ != nullptr) {
+      library_->destroyed(this);
+    }
+  }
+
+ protected:
+
+  void *loadFunction(const std::string &function_name,
+                     bool required = true) override {
+    return library_->loadFunction(function_name, required);
+  }
+
+  void modelLibraryClosed() override {
+    library_ = nullptr;
+    CppAD::cg::FunctorGenericModel<Base>::modelLibraryClosed();
+  }
+};
+
+/**
+ * CPU library that has been linked into the executable as a static archive
+ * (see `GeneratedCodeGen::compile_static_library`). The functions of the
+ * models are looked up in the table provided by the registration function of
+ * the library instead of the dynamic symbol table.
+ */
+template <class Base>
+class StaticModelLibrary : public CppAD::cg::FunctorModelLibrary<Base> {
+  friend class StaticModel<Base>;
+
+ public:
+  explicit StaticModelLibrary(StaticLibraryRegistration registration) {
+    registration(&StaticModelLibrary::add_function, this);
+    this->validate();
+  }
+
+  StaticModelLibrary(const StaticModelLibrary &) = delete;
+  StaticModelLibrary &operator=(const StaticModelLibrary &) = delete;
+
+  ~StaticModelLibrary() override { cleanUp(); }
+
+  std::unique_ptr<CppAD::cg::FunctorGenericModel<Base>> modelFunctor(
+      const std::string &model_name) override {
+    if (this->_modelNames.find(model_name) == this->_modelNames.end()) {
+      return nullptr;
+    }
+    return std::unique_ptr<CppAD::cg::FunctorGenericModel<Base>>(
+        new StaticModel<Base>(this, model_name));
+  }
+
+  void *loadFunction(const std::string &function_name,
+                     bool required = true) override {
+    const auto it = functions_.find(function_name);
+    if (it == functions_.end()) {
+      if (required) {
+        throw std::runtime_error("Static library does not contain function \"" +
+                                 function_name + "\".");
+      }
+      return nullptr;
+    }
+    return it->second;
+  }
+
+ protected:
+  std::map<std::string, void *> functions_;
+  // models that have been created and not destroyed yet
+  std::set<StaticModel<Base> *> models_;
+
+  static void add_function(void *context, const char *name, void *function) {
+    static_cast<StaticModelLibrary *>(context)->functions_[name] = function;
+  }
+
+  void registerModel(StaticModel<Base> &model) {
+    if (!models_.insert(&model).second) {
+      throw std::runtime_error("Failed to register model \"" +
+                               model.getName() + "\".");
+    }
+  }
+
+  void destroyed(StaticModel<Base> *model) { models_.erase(model); }
+
+  // closes the library as LinuxDynamicLib does before unloading: detaches the
+  // models that are still alive and runs the library's close function
+  void cleanUp() {
+    for (StaticModel<Base> *model : models_) {
+      model->modelLibraryClosed();
+    }
+    models_.clear();
+    if (this->_onClose != nullptr) {
+      (*this->_onClose)();
+      this->_onClose = nullptr;
+    }
+  }
+};
+}  // namespace autogen
+
+/**
+ * Makes the static CPU library `library` (the name passed to
+ * `GeneratedCodeGen::compile_static_library`, which must be a valid
+ * identifier) that has been linked into the executable available to
+ * `load_precompiled_library`. Use at namespace scope of a source file of the
+ * executable.
+ */
+#define AUTOGEN_REGISTER_STATIC_LIBRARY(library)                              \
+  extern "C" void autogen_register_##library(                               \
+      autogen::StaticLibraryFunctionCallback, void *);                      \
+  static const bool autogen_static_library_##library##_registered =         \
+      autogen::StaticLibraryRegistry::add(#library,                         \
+                                          &autogen_register_##library)
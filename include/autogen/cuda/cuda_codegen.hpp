@@ -26,6 +26,11 @@ class CudaModelSourceGen : public CppAD::cg::ModelCSourceGen<Base> {
    */
   bool kernel_only_{false};
 
+  /**
+   * Whether the loops among the related dependents have been detected.
+   */
+  bool loops_prepared_{false};
+
  public:
   CudaModelSourceGen(CppAD::ADFun<CppAD::cg::CG<Base>> &fun, std::string model,
                      bool kernel_only = false)
@@ -69,6 +74,23 @@ class CudaModelSourceGen : public CppAD::cg::ModelCSourceGen<Base> {
     jac_output_sparsity_ = sparsity;
   }
 
+  /**
+   * Runs CppADCodeGen's pattern-based loop detection on the related
+   * dependents (see `setRelatedDependents()`) before the first source is
+   * generated. Functions with a global input keep the unrolled code.
+   */
+  void prepare_loops() {
+    if (loops_prepared_) {
+      return;
+    }
+    loops_prepared_ = true;
+    if (global_input_dim() > 0) {
+      return;
+    }
+    // does nothing if no related dependents have been defined
+    this->generateLoops();
+  }
+
   const std::map<std::string, std::string> &sources() {
     auto mtt = CppAD::cg::MultiThreadingType::NONE;
     CppAD::cg::JobTimer *timer = nullptr;
@@ -123,6 +145,8 @@ class CudaModelSourceGen : public CppAD::cg::ModelCSourceGen<Base> {
       }
     }
 
+    prepare_loops();
+
     std::vector<CGBase> jac(this->_jacSparsity.rows.size());
     bool forward = local_input_dim() + global_input_dim() <= output_dim();
     if (this->_loopTapes.empty()) {
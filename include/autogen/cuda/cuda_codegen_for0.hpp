@@ -35,6 +35,7 @@ std::string CudaModelSourceGen<Base>::forward_zero_source() {
 
   std::vector<CGBase> dep;
 
+  prepare_loops();
   if (this->_loopTapes.empty()) {
     dep = this->_fun.Forward(0, indVars);
   } else {
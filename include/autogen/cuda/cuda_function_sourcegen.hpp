@@ -45,7 +45,11 @@ struct CudaFunctionSourceGen {
                    bool is_function = false) const {
     std::string kernel_name = function_name;
     if (is_function) {
-      code << "__device__\n";
+      code << "__device__";
+      if (LanguageCuda<Base>::noinline_functions) {
+        code << " __noinline__";
+      }
+      code << "\n";
     } else {
       code << "\n__global__\n";
       kernel_name += "_kernel";
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <cppad/cg.hpp>
-#include <unordered_map>
+#include <map>
+#include <stdexcept>
 
+#include "autogen/core/codegen.hpp"
 #include "cuda_variable_name_gen.hpp"
 
 namespace autogen {
@@ -24,8 +26,9 @@ class LanguageCuda : public CppAD::cg::LanguageC<Base> {
 
   bool assume_cuda_namegen{true};
 
-  // maps constants to their variable names
-  std::unordered_map<std::string, std::string> constants_;
+  // maps constants to their variable names (ordered so that the constant
+  // declarations are emitted in the same order in every run)
+  std::map<std::string, std::string> constants_;
 
  public:
   LanguageCuda(bool assume_cuda_namegen = true, size_t spaces = 2)
@@ -46,6 +49,12 @@ class LanguageCuda : public CppAD::cg::LanguageC<Base> {
    */
   static inline bool add_debug_prints{false};
 
+  /**
+   * Whether to prevent the device functions of atomic functions from being
+   * inlined, so that they appear as separate functions in profilers.
+   */
+  static inline bool noinline_functions{false};
+
   virtual void pushAtomicForwardOp(Node &atomicFor) {
     using namespace CppAD::cg;
     CPPADCG_ASSERT_KNOWN(
@@ -107,7 +116,29 @@ class LanguageCuda : public CppAD::cg::LanguageC<Base> {
       //                    << "printf(\"\\n\");\n";
     }
 
-    if (q == 0 && p == 0) {
+    const auto &mapped_atomics = CodeGenData<Base>::mapped_atomics;
+    const auto mapped = mapped_atomics.find(fun_name);
+    if (q == 0 && p == 0 && mapped != mapped_atomics.end()) {
+      // apply the element function of a mapped atomic in a loop instead of
+      // calling the mapped function that unrolls the element calls
+      // the sources may be generated concurrently, so the shared map of
+      // traces must not be modified here
+      const auto &traces = *CodeGenData<Base>::traces;
+      const auto element_it = traces.find(mapped->second.element_name);
+      if (element_it == traces.end()) {
+        throw std::runtime_error("Element function \"" +
+                                 mapped->second.element_name +
+                                 "\" of mapped atomic function \"" +
+                                 fun_name + "\" has not been traced.");
+      }
+      const auto &element = element_it->second;
+      this->_streamStack << this->_indentation << "for (int k = 0; k < "
+                         << mapped->second.num_elements << "; ++k) "
+                         << element.name << "_forward_zero("
+                         << this->_ATOMIC_TY << " + k * " << element.output_dim
+                         << ", " << this->_ATOMIC_TX << " + k * "
+                         << element.input_dim << ");\n";
+    } else if (q == 0 && p == 0) {
       this->_streamStack << this->_indentation << fun_name << "_forward_zero("
                          << this->_ATOMIC_TY << ", " << this->_ATOMIC_TX
                          << ");\n";
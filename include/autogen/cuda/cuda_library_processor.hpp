@@ -3,6 +3,7 @@
 #include <filesystem>
 
 #include "autogen/utils/stopwatch.hpp"
+#include "autogen/core/parallel_codegen.hpp"
 #include "autogen/utils/system.hpp"
 #include "cuda_codegen.hpp"
 #include "cuda_language.hpp"
@@ -43,6 +44,22 @@ class CudaLibraryProcessor {
    */
   bool debug_mode_{false};
 
+  /**
+   * Whether to compile with line information and keep the device functions
+   * of atomic functions as separate functions for profiling.
+   */
+  bool line_info_{false};
+
+  /**
+   * Maps the name of each model to the names of its generated source files.
+   */
+  std::map<std::string, std::vector<std::string>> model_sources_;
+
+  /**
+   * Number of threads that generate the sources of the models concurrently.
+   */
+  std::size_t num_codegen_threads_{1};
+
  public:
   CudaLibraryProcessor(CudaModelSourceGen<Base> *model,
                        const std::string &library_name = "",
@@ -75,6 +92,19 @@ class CudaLibraryProcessor {
   bool &debug_mode() { return debug_mode_; }
   const bool &debug_mode() const { return debug_mode_; }
 
+  bool &line_info() { return line_info_; }
+  const bool &line_info() const { return line_info_; }
+
+  const std::map<std::string, std::vector<std::string>> &model_sources()
+      const {
+    return model_sources_;
+  }
+
+  std::size_t &num_codegen_threads() { return num_codegen_threads_; }
+  const std::size_t &num_codegen_threads() const {
+    return num_codegen_threads_;
+  }
+
   const std::vector<CudaModelSourceGen<Base> *> &models() const {
     return models_;
   }
@@ -109,46 +139,33 @@ class CudaLibraryProcessor {
   void generate_code() {
     gen_srcs_.clear();
     LanguageCuda<Base>::add_debug_prints = debug_mode_;
+    LanguageCuda<Base>::noinline_functions = line_info_;
     sources_.push_back(std::make_pair("util.h", util_header_src()));
     sources_.push_back(std::make_pair("model_info.h", model_info_header_src()));
-    for (auto *cgen : models_) {
-      std::string extension = cgen->is_kernel_only() ? "cuh" : "cu";
-      if (cgen->isCreateForwardZero()) {
-        std::string src_name = cgen->getName() + "_forward_zero." + extension;
-        // generate CUDA code
-        std::string source = cgen->forward_zero_source();
-        sources_.push_back(std::make_pair(src_name, source));
-        gen_srcs_.push_back(src_name);
-      }
-      if (cgen->isCreateSparseForwardOne()) {
-        std::string src_name = cgen->getName() + "_forward_one." + extension;
-        // generate CUDA code
-        std::string source = cgen->forward_one_source(sources_);
-        sources_.push_back(std::make_pair(src_name, source));
-        gen_srcs_.push_back(src_name);
-      }
-      if (cgen->isCreateReverseOne()) {
-        std::string src_name = cgen->getName() + "_reverse_one." + extension;
-        // generate CUDA code
-        std::string source = cgen->reverse_one_source(sources_);
-        sources_.push_back(std::make_pair(src_name, source));
-        gen_srcs_.push_back(src_name);
-      }
-      if (cgen->isCreateJacobian()) {
-        std::string src_name = cgen->getName() + "_jacobian." + extension;
-        // generate CUDA code
-        std::string source = cgen->jacobian_source();
-        sources_.push_back(std::make_pair(src_name, source));
-        gen_srcs_.push_back(src_name);
-      }
-      if (cgen->isCreateSparseJacobian()) {
-        std::string src_name =
-            cgen->getName() + "_sparse_jacobian." + extension;
-        // generate CUDA code
-        std::string source = cgen->sparse_jacobian_source();
-        sources_.push_back(std::make_pair(src_name, source));
-        gen_srcs_.push_back(src_name);
+    // generate the sources of each model concurrently and merge them in the
+    // order of the models afterwards
+    std::vector<CudaModelSourceGen<Base> *> models(models_.begin(),
+                                                   models_.end());
+    std::vector<std::vector<std::pair<std::string, std::string>>> model_srcs(
+        models.size());
+    std::vector<std::vector<std::string>> model_gen_srcs(models.size());
+    std::vector<std::set<std::string>> tapes;
+    for (auto *cgen : models) {
+      tapes.push_back(CodeGenData<Base>::used_tapes(cgen->getName()));
+    }
+    run_codegen_jobs<Base>(tapes, num_codegen_threads_, [&](std::size_t i) {
+      generate_model_code(models[i], model_srcs[i], model_gen_srcs[i]);
+    });
+    model_sources_.clear();
+    for (std::size_t i = 0; i < models.size(); ++i) {
+      auto &names = model_sources_[models[i]->getName()];
+      for (const auto &src : model_srcs[i]) {
+        names.push_back(src.first);
       }
+      sources_.insert(sources_.end(), model_srcs[i].begin(),
+                      model_srcs[i].end());
+      gen_srcs_.insert(gen_srcs_.end(), model_gen_srcs[i].begin(),
+                       model_gen_srcs[i].end());
     }
     // generate "main" source file
     std::stringstream main_file;
@@ -195,6 +212,9 @@ class CudaLibraryProcessor {
         << ",-v ";
     cmd << "--ptxas-options=-v "
         << "-rdc=true ";
+    if (line_info_) {
+      cmd << "-lineinfo ";
+    }
     // if (debug_mode_) {
     //   cmd << "-G ";
     // }
@@ -229,6 +249,52 @@ class CudaLibraryProcessor {
   }
 
  protected:
+  /**
+   * Generates the CUDA code of a single model.
+   */
+  static void generate_model_code(
+      CudaModelSourceGen<Base> *cgen,
+      std::vector<std::pair<std::string, std::string>> &sources,
+      std::vector<std::string> &gen_srcs) {
+    std::string extension = cgen->is_kernel_only() ? "cuh" : "cu";
+    if (cgen->isCreateForwardZero()) {
+      std::string src_name = cgen->getName() + "_forward_zero." + extension;
+      // generate CUDA code
+      std::string source = cgen->forward_zero_source();
+      sources.push_back(std::make_pair(src_name, source));
+      gen_srcs.push_back(src_name);
+    }
+    if (cgen->isCreateSparseForwardOne()) {
+      std::string src_name = cgen->getName() + "_forward_one." + extension;
+      // generate CUDA code
+      std::string source = cgen->forward_one_source(sources);
+      sources.push_back(std::make_pair(src_name, source));
+      gen_srcs.push_back(src_name);
+    }
+    if (cgen->isCreateReverseOne()) {
+      std::string src_name = cgen->getName() + "_reverse_one." + extension;
+      // generate CUDA code
+      std::string source = cgen->reverse_one_source(sources);
+      sources.push_back(std::make_pair(src_name, source));
+      gen_srcs.push_back(src_name);
+    }
+    if (cgen->isCreateJacobian()) {
+      std::string src_name = cgen->getName() + "_jacobian." + extension;
+      // generate CUDA code
+      std::string source = cgen->jacobian_source();
+      sources.push_back(std::make_pair(src_name, source));
+      gen_srcs.push_back(src_name);
+    }
+    if (cgen->isCreateSparseJacobian()) {
+      std::string src_name =
+          cgen->getName() + "_sparse_jacobian." + extension;
+      // generate CUDA code
+      std::string source = cgen->sparse_jacobian_source();
+      sources.push_back(std::make_pair(src_name, source));
+      gen_srcs.push_back(src_name);
+    }
+  }
+
   std::string util_header_src() const {
     assert(!models_.empty());
     std::ostringstream code;
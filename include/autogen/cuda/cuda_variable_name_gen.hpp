@@ -43,5 +43,22 @@ public:
 
     return this->_ss.str();
   }
+
+  inline std::string generateIndexedIndependent(
+      const CppAD::cg::OperationNode<Base> &independent, size_t id,
+      const CppAD::cg::IndexPattern &ip) override {
+    if (global_input_dim_ > 0) {
+      // not reached, `CudaModelSourceGen::prepare_loops()` does not detect
+      // loops in functions with a global input
+      throw std::logic_error(
+          "CUDA code generation with loops is not supported for functions "
+          "that have global input.");
+    }
+    // without global input, all independent variables are thread-local
+    std::string name =
+        CppAD::cg::LangCDefaultVariableNameGenerator<Base>::
+            generateIndexedIndependent(independent, id, ip);
+    return local_name_ + name.substr(this->_indepName.size());
+  }
 };
 } // namespace autogen
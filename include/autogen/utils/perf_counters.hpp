@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "system.hpp"
+
+#if AUTOGEN_SYSTEM_LINUX && !AUTOGEN_SYSTEM_APPLE
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define AUTOGEN_HAS_PERF_EVENTS 1
+#endif
+
+namespace autogen {
+enum PerfCounterType {
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_VECTOR_INSTRUCTIONS,
+  PERF_NUM_COUNTERS
+};
+
+/**
+ * Accumulated hardware counter readings and timings of an entry point.
+ * `thread_time` is the sum of the time spent by all threads that evaluated
+ * the entry point.
+ */
+struct PerfSample {
+  std::size_t calls{0};
+  std::size_t evaluations{0};
+  double thread_time{0};
+  std::array<std::uint64_t, PERF_NUM_COUNTERS> counters{};
+
+  PerfSample &operator+=(const PerfSample &other) {
+    calls += other.calls;
+    evaluations += other.evaluations;
+    thread_time += other.thread_time;
+    for (int i = 0; i < PERF_NUM_COUNTERS; ++i) {
+      counters[i] += other.counters[i];
+    }
+    return *this;
+  }
+
+  std::uint64_t cycles() const { return counters[PERF_CYCLES]; }
+  std::uint64_t instructions() const { return counters[PERF_INSTRUCTIONS]; }
+  std::uint64_t cache_misses() const { return counters[PERF_CACHE_MISSES]; }
+  std::uint64_t vector_instructions() const {
+    return counters[PERF_VECTOR_INSTRUCTIONS];
+  }
+};
+
+/**
+ * Hardware performance counters of the calling thread, opened as one
+ * `perf_event_open` group so that all counters cover the same instructions.
+ * Counters that are not supported by the system (or not permitted by
+ * `/proc/sys/kernel/perf_event_paranoid`) read as zero.
+ */
+class PerfCounterGroup {
+ public:
+  /**
+   * Raw PMU event code used to count vector instructions. There is no
+   * generic perf event for these, so counting is disabled unless the code of
+   * the CPU at hand is set before the first measurement of a thread, e.g.
+   * 0xfcc7 (FP_ARITH_INST_RETIRED, all packed variants) on recent Intel
+   * CPUs.
+   */
+  static inline std::uint64_t vector_instruction_event{0};
+
+  PerfCounterGroup() { fds_.fill(-1); }
+  PerfCounterGroup(const PerfCounterGroup &) = delete;
+  PerfCounterGroup &operator=(const PerfCounterGroup &) = delete;
+  ~PerfCounterGroup() {
+#ifdef AUTOGEN_HAS_PERF_EVENTS
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+#endif
+  }
+
+  bool available() {
+    open();
+    return fds_[PERF_CYCLES] >= 0;
+  }
+
+  void start() {
+    start_time_ = std::chrono::steady_clock::now();
+#ifdef AUTOGEN_HAS_PERF_EVENTS
+    if (!available()) {
+      return;
+    }
+    ioctl(fds_[PERF_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds_[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  /**
+   * Stops counting and adds the readings since the last call to `start()` to
+   * `sample`.
+   */
+  void stop(PerfSample &sample) {
+    // steady_clock in nanoseconds, calls of small models take less than a
+    // microsecond
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_time_);
+    sample.thread_time += static_cast<double>(elapsed.count()) * 1e-9;
+#ifdef AUTOGEN_HAS_PERF_EVENTS
+    if (fds_[PERF_CYCLES] < 0) {
+      return;
+    }
+    ioctl(fds_[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // layout of PERF_FORMAT_GROUP: number of counters followed by the values
+    // in the order the counters were added to the group
+    std::array<std::uint64_t, PERF_NUM_COUNTERS + 1> buffer{};
+    if (read(fds_[PERF_CYCLES], buffer.data(),
+             sizeof(std::uint64_t) * buffer.size()) <= 0) {
+      return;
+    }
+    std::size_t k = 1;
+    for (int i = 0; i < PERF_NUM_COUNTERS && k <= buffer[0]; ++i) {
+      if (fds_[i] >= 0) {
+        sample.counters[i] += buffer[k++];
+      }
+    }
+#endif
+  }
+
+ private:
+  std::array<int, PERF_NUM_COUNTERS> fds_;
+  bool opened_{false};
+  std::chrono::steady_clock::time_point start_time_;
+
+  void open() {
+    if (opened_) {
+      return;
+    }
+    opened_ = true;
+#ifdef AUTOGEN_HAS_PERF_EVENTS
+    fds_[PERF_CYCLES] =
+        open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (fds_[PERF_CYCLES] < 0) {
+      return;
+    }
+    fds_[PERF_INSTRUCTIONS] = open_event(
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fds_[PERF_CYCLES]);
+    fds_[PERF_CACHE_MISSES] = open_event(
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fds_[PERF_CYCLES]);
+    if (vector_instruction_event != 0) {
+      fds_[PERF_VECTOR_INSTRUCTIONS] = open_event(
+          PERF_TYPE_RAW, vector_instruction_event, fds_[PERF_CYCLES]);
+    }
+#endif
+  }
+
+#ifdef AUTOGEN_HAS_PERF_EVENTS
+  static int open_event(std::uint32_t type, std::uint64_t config,
+                        int group_fd) {
+    perf_event_attr attr{};
+    attr.size = sizeof(perf_event_attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // measure the calling thread on any CPU
+    return static_cast<int>(
+        syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+  }
+#endif
+};
+
+/**
+ * Performance counters of the entry points of a model, aggregated across all
+ * threads that evaluated them.
+ */
+class PerfCounterReport {
+ public:
+  void add(const std::string &entry_point, const PerfSample &sample) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_[entry_point] += sample;
+  }
+
+  std::map<std::string, PerfSample> samples() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return samples_;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_.clear();
+  }
+
+  /**
+   * Prints the counters per evaluation, i.e. per sample of a batch.
+   */
+  void print(const std::string &title, std::ostream &os = std::cout) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    os << "Performance counters of \"" << title << "\"\n";
+    for (const auto &[entry_point, s] : samples_) {
+      const double n =
+          static_cast<double>(std::max<std::size_t>(s.evaluations, 1));
+      os << "  " << std::left << std::setw(18) << entry_point << std::right
+         << " calls: " << s.calls << "  evaluations: " << s.evaluations
+         << "  time/eval: " << s.thread_time / n * 1e6 << " us"
+         << "  cycles/eval: " << s.cycles() / n
+         << "  instructions/eval: " << s.instructions() / n << "  IPC: "
+         << (s.cycles() > 0 ? static_cast<double>(s.instructions()) /
+                                  static_cast<double>(s.cycles())
+                            : 0.0)
+         << "  cache misses/eval: " << s.cache_misses() / n
+         << "  vector instructions/eval: " << s.vector_instructions() / n
+         << "\n";
+    }
+  }
+
+ private:
+  std::map<std::string, PerfSample> samples_;
+  mutable std::mutex mutex_;
+};
+
+/**
+ * Measures the calling thread while in scope and adds the readings to the
+ * report (does nothing if the report is null). Scopes nested in an active
+ * scope of the same thread are not measured separately.
+ */
+class ScopedPerfCounters {
+ public:
+  ScopedPerfCounters(PerfCounterReport *report, const char *entry_point,
+                     std::size_t evaluations, std::size_t calls = 1)
+      : report_(report && !active() ? report : nullptr),
+        entry_point_(entry_point) {
+    if (report_) {
+      active() = true;
+      sample_.calls = calls;
+      sample_.evaluations = evaluations;
+      counters().start();
+    }
+  }
+  ~ScopedPerfCounters() {
+    if (report_) {
+      counters().stop(sample_);
+      report_->add(entry_point_, sample_);
+      active() = false;
+    }
+  }
+
+  static PerfCounterGroup &counters() {
+    static thread_local PerfCounterGroup group;
+    return group;
+  }
+
+ private:
+  static bool &active() {
+    static thread_local bool is_active = false;
+    return is_active;
+  }
+
+  PerfCounterReport *report_;
+  const char *entry_point_;
+  PerfSample sample_;
+};
+}  // namespace autogen
@@ -23,6 +23,11 @@
 #include <cppad/cg.hpp>
 #include <fstream>
 
+#if AUTOGEN_SYSTEM_LINUX && !AUTOGEN_SYSTEM_APPLE
+#include <malloc.h>
+#include <unistd.h>
+#endif
+
 #include "filesystem.hpp"
 
 namespace autogen {
@@ -88,4 +93,25 @@ static std::string find_exe(const std::string &name,
                              "\"");
   }
 }
-}  // namespace autogen
\ No newline at end of file
+
+// returns the resident memory of this process in bytes (0 if unavailable)
+static std::size_t resident_memory() {
+#if AUTOGEN_SYSTEM_LINUX && !AUTOGEN_SYSTEM_APPLE
+  std::ifstream statm("/proc/self/statm");
+  std::size_t total_pages = 0, resident_pages = 0;
+  if (!(statm >> total_pages >> resident_pages)) {
+    return 0;
+  }
+  return resident_pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+// returns freed heap memory to the operating system where supported
+static void trim_heap() {
+#if AUTOGEN_SYSTEM_LINUX && !AUTOGEN_SYSTEM_APPLE && defined(__GLIBC__)
+  malloc_trim(0);
+#endif
+}
+}  // namespace autogen
@@ -231,6 +231,16 @@ PYBIND11_MODULE(_autogen, m) {
                         CodeGenData<BaseScalar>::invocation_order);
   });
 
+  py::class_<autogen::IsaVariant>(m, "IsaVariant")
+      .def(py::init<>())
+      .def_readwrite("name", &autogen::IsaVariant::name)
+      .def_readwrite("compile_flags", &autogen::IsaVariant::compile_flags)
+      .def_readwrite("features", &autogen::IsaVariant::features);
+  m.def("default_isa_variants", &autogen::default_isa_variants,
+        "Instruction set variants for AVX-512 and AVX2 hosts");
+  m.def("cpu_supports", &autogen::cpu_supports,
+        "Whether the CPU supports the instruction set extension");
+
   py::class_<autogen::GeneratedCppAD>(m, "GeneratedCppAD")
       .def(py::init<std::shared_ptr<ADFun>>())
       .def(py::init([](std::shared_ptr<ADFun> fun) {
@@ -276,6 +286,27 @@ PYBIND11_MODULE(_autogen, m) {
             return outputs;
           },
           "Evaluates the Jacobian of the function")
+      .def_readwrite("use_sparse_jacobian",
+                     &autogen::GeneratedCppAD::use_sparse_jacobian)
+      .def(
+          "jacobian_sparsity",
+          [](autogen::GeneratedCppAD& gen,
+             const std::vector<BaseScalar>& input) {
+            const auto& pattern = gen.jacobian_sparsity(input);
+            return std::make_pair(pattern.row_offsets, pattern.col_indices);
+          },
+          "Returns the row offsets and column indices of the CSR sparsity "
+          "pattern of the Jacobian")
+      .def(
+          "sparse_jacobian",
+          [](autogen::GeneratedCppAD& gen,
+             const std::vector<std::vector<BaseScalar>>& local_inputs,
+             const std::vector<BaseScalar>& global_input) {
+            std::vector<std::vector<BaseScalar>> values;
+            gen.sparse_jacobian(local_inputs, values, global_input);
+            return values;
+          },
+          "Evaluates the nonzero entries of the Jacobians in CSR order")
       .def_property_readonly("input_dim", &autogen::GeneratedCppAD::input_dim)
       .def_property_readonly("local_input_dim",
                              &autogen::GeneratedCppAD::local_input_dim)
@@ -390,6 +421,65 @@ PYBIND11_MODULE(_autogen, m) {
       .def_readwrite("generate_jacobian",
                      &autogen::GeneratedCodeGen::generate_jacobian)
       .def_readwrite("debug_mode", &autogen::GeneratedCodeGen::debug_mode)
+      .def_readwrite("num_codegen_threads",
+                     &autogen::GeneratedCodeGen::num_codegen_threads)
+      .def_readwrite("finite_difference_jacobian",
+                     &autogen::GeneratedCodeGen::finite_difference_jacobian)
+      .def_readwrite("central_differences",
+                     &autogen::GeneratedCodeGen::central_differences)
+      .def_readwrite("finite_diff_eps",
+                     &autogen::GeneratedCodeGen::finite_diff_eps)
+      .def_readwrite("upgrade_to_exact_jacobian",
+                     &autogen::GeneratedCodeGen::upgrade_to_exact_jacobian)
+      .def_readwrite("lazy_jacobian",
+                     &autogen::GeneratedCodeGen::lazy_jacobian)
+      .def_readwrite("background_jacobian",
+                     &autogen::GeneratedCodeGen::background_jacobian)
+      .def("wait_for_jacobian_upgrade",
+           &autogen::GeneratedCodeGen::wait_for_jacobian_upgrade)
+      .def_readwrite("related_dependents",
+                     &autogen::GeneratedCodeGen::related_dependents)
+      .def_readwrite("profile_performance",
+                     &autogen::GeneratedCodeGen::profile_performance)
+      .def_readwrite("annotate_sources",
+                     &autogen::GeneratedCodeGen::annotate_sources)
+      .def_readwrite("isa_variants", &autogen::GeneratedCodeGen::isa_variants)
+      .def_readwrite("autotune_on_first_use",
+                     &autogen::GeneratedCodeGen::autotune_on_first_use)
+      .def_readwrite("autotune_repetitions",
+                     &autogen::GeneratedCodeGen::autotune_repetitions)
+      .def(
+          "autotune",
+          [](autogen::GeneratedCodeGen &gen,
+             const std::vector<std::vector<BaseScalar>> &local_inputs,
+             const std::vector<BaseScalar> &global_input) {
+            gen.autotune(local_inputs, global_input);
+          },
+          "Benchmarks the parallelization settings of the batched "
+          "evaluations and saves the fastest ones next to the library",
+          py::arg("local_inputs"),
+          py::arg("global_input") = std::vector<BaseScalar>{},
+          py::call_guard<py::scoped_ostream_redirect,
+                         py::scoped_estream_redirect>())
+      .def("export_header", &autogen::GeneratedCodeGen::export_header,
+           "Writes the function to a self-contained C++ header",
+           py::arg("filename"), py::arg("namespace") = "")
+      .def("compile_static_library",
+           &autogen::GeneratedCodeGen::compile_static_library,
+           "Compiles the CPU code to a static archive for linking into an "
+           "executable",
+           py::arg("library_name") = "")
+      .def("print_performance_report",
+           [](const autogen::GeneratedCodeGen &gen) {
+             gen.print_performance_report();
+           })
+      .def("reset_performance_report",
+           &autogen::GeneratedCodeGen::reset_performance_report)
+      .def("set_repeated_output_blocks",
+           &autogen::GeneratedCodeGen::set_repeated_output_blocks,
+           "Marks outputs as related that are block_size indices apart to "
+           "enable loop detection",
+           py::arg("block_size"))
       .def_property_readonly("local_input_dim",
                              &autogen::GeneratedCodeGen::local_input_dim)
       .def_property_readonly("output_dim",
@@ -479,7 +569,9 @@ PYBIND11_MODULE(_autogen, m) {
                     // } else if (get_scope()->mode == SCALAR_CODEGEN) {
                     //   retrieve_tape<ADCGScalar>();
                     // }
-                    trace_existing_atomics();
+                    // Python functions may be called while tracing, which
+                    // requires the GIL held by this thread
+                    trace_existing_atomics(1);
                   })
       .def_static("call_bridge", [](const std::string& name,
                                     const ADCGVector& input) {